@@ -2,7 +2,9 @@
 #define DEVICES_BLOCK_H
 
 #include <stddef.h>
+#include <stdbool.h>
 #include <inttypes.h>
+#include <list.h>
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -18,10 +20,36 @@ typedef uint32_t block_sector_t;
    printf ("sector=%"PRDSNu"\n", sector); */
 #define PRDSNu PRIu32
 
+/* Most sectors that one struct block_request may cover. */
+#define BLOCK_REQUEST_MAX 256
+
 /* Higher-level interface for file systems, etc. */
 
 struct block;
 
+/* An asynchronous transfer submitted with block_submit().
+
+   The submitter fills in SECTOR through AUX and must keep
+   the request and its buffer alive until COMPLETE is called.
+   COMPLETE may run in an external interrupt handler, so it must
+   not sleep; typically it ups a semaphore.  BUFFER is accessed
+   from interrupt context too, so it must be in kernel virtual
+   memory. */
+struct block_request
+  {
+    block_sector_t sector;      /* First sector. */
+    size_t cnt;                 /* Sector count, 1...BLOCK_REQUEST_MAX. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    bool write;                 /* True to write, false to read. */
+    void (*complete) (struct block_request *); /* Called when done. */
+    void *aux;                  /* For use by COMPLETE. */
+
+    /* Owned by the driver until COMPLETE is called. */
+    struct list_elem elem;      /* Element in sorted queue or batch. */
+    struct list_elem fifo_elem; /* Element in arrival-order queue. */
+    int64_t deadline;           /* Timer tick by which to serve it. */
+  };
+
 /* Type of a block device. */
 enum block_type
   {
@@ -53,6 +81,10 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, void *, size_t cnt);
+void block_write_multiple (struct block *, block_sector_t, const void *,
+                           size_t cnt);
+void block_submit (struct block *, struct block_request *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
@@ -65,6 +97,20 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Transfer CNT consecutive sectors in as few requests as the
+       device allows.  Either may be null, in which case the
+       block layer calls read or write once per sector. */
+    void (*read_multiple) (void *aux, block_sector_t, void *buffer,
+                           size_t cnt);
+    void (*write_multiple) (void *aux, block_sector_t, const void *buffer,
+                            size_t cnt);
+
+    /* Queues a request and returns without waiting for it.  May
+       be null, in which case block_submit() carries out the
+       request synchronously before calling its completion
+       function. */
+    void (*submit) (void *aux, struct block_request *);
   };
 
 struct block *block_register (const char *name, enum block_type,
@@ -3,15 +3,28 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/block.h"
 #include "devices/partition.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   Transfers use bus master DMA when a PCI IDE controller that
+   supports it is present (see "Programming Interface for Bus
+   Master IDE Controller", rev. 1.0), and otherwise programmed
+   I/O with READ/WRITE MULTIPLE when the disk supports it.
+
+   Requests are queued per disk and carried out one command at a
+   time per channel, driven by the channel's interrupt handler.
+   See "Request queuing" below. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -34,6 +47,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +63,43 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA with retries. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA with retries. */
+
+/* Most sectors that one command can transfer.  The sector count
+   register holds 8 bits, with 0 meaning 256. */
+#define MAX_XFER_SECTORS 256
+
+/* Bus master IDE register port addresses. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits. */
+#define BM_STA_ERROR 0x02       /* Transfer failed (write 1 to clear). */
+#define BM_STA_INTR 0x04        /* Interrupt raised (write 1 to clear). */
+
+/* Physical region descriptor.  The bus master reads a table of
+   these, which must not cross a 64 kB boundary, to learn where
+   in physical memory to transfer data. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address of region. */
+    uint16_t size;              /* Size in bytes, 0 meaning 64 kB. */
+    uint16_t flags;             /* PRD_EOT for the last region. */
+  };
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* PCI configuration space ports. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +108,13 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple_cnt;           /* Sectors per READ/WRITE MULTIPLE block,
+                                   1 if those commands are not in use. */
+    bool dma;                   /* Use bus master DMA? */
+
+    struct list queue;          /* Pending requests, ordered by sector. */
+    struct list fifo;           /* Pending requests, oldest first. */
+    block_sector_t head_pos;    /* Sector after the last one served. */
   };
 
 /* An ATA channel (aka controller).
@@ -67,11 +125,28 @@ struct channel
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus master base I/O port, 0 if none. */
+    struct prd *prdt;           /* Physical region descriptor table. */
+
+    /* Command in progress, if BUSY_DISK is non-null. */
+    struct ata_disk *busy_disk; /* Disk that the command is for. */
+    struct list batch;          /* Requests it serves, in sector order. */
+    block_sector_t batch_sector; /* First sector. */
+    size_t batch_cnt;           /* Number of sectors. */
+    bool batch_write;           /* True if writing to the disk. */
+    bool batch_dma;             /* True if using bus master DMA. */
+    size_t pio_left;            /* Sectors not yet moved by PIO. */
+    struct list_elem *pio_req;  /* Request whose data PIO moves next. */
+    size_t pio_ofs;             /* Sectors of PIO_REQ already moved. */
+    bool retry;                 /* Reissue the command in progress? */
+    int next_dev;               /* Disk to consider first next time. */
+    struct semaphore start_sema; /* Up'd to have the starter thread
+                                   start a command. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -85,10 +160,20 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void init_bus_master (void);
+static void set_multiple_mode (struct ata_disk *, int multiple_cnt);
+
+static void ide_submit (void *d, struct block_request *);
+static void start_next (struct channel *);
+static bool choose_batch (struct channel *);
+static void start_batch (struct channel *);
+static thread_func starter;
+static void command_interrupt (struct channel *);
+
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
-static void input_sector (struct channel *, void *);
-static void output_sector (struct channel *, const void *);
+static void input_sectors (struct channel *, void *, size_t cnt);
+static void output_sectors (struct channel *, const void *, size_t cnt);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -103,6 +188,8 @@ ide_init (void)
 {
   size_t chan_no;
 
+  init_bus_master ();
+
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
       struct channel *c = &channels[chan_no];
@@ -123,9 +210,13 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->busy_disk = NULL;
+      list_init (&c->batch);
+      c->retry = false;
+      c->next_dev = 0;
+      sema_init (&c->start_sema, 0);
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +227,11 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple_cnt = 1;
+          d->dma = false;
+          list_init (&d->queue);
+          list_init (&d->fifo);
+          d->head_pos = 0;
         }
 
       /* Register interrupt handler. */
@@ -152,9 +248,74 @@ ide_init (void)
       for (dev_no = 0; dev_no < 2; dev_no++)
         if (c->devices[dev_no].is_ata)
           identify_ata_device (&c->devices[dev_no]);
+
+      thread_create (c->name, PRI_MAX, starter, c);
     }
 }
 
+/* Bus master detection. */
+
+/* Returns the 32-bit register at offset REG in the PCI
+   configuration space of function FUNC of device DEV on bus 0. */
+static uint32_t
+pci_read_config (int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit register at offset REG in the PCI
+   configuration space of function FUNC of device DEV on bus 0. */
+static void
+pci_write_config (int dev, int func, int reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Looks on PCI bus 0 for an IDE controller capable of bus
+   mastering, such as the PIIX3 emulated by QEMU and Bochs.  If
+   one is found, enables bus mastering on it and sets up DMA for
+   the two legacy channels.  Otherwise, or if the PRD tables
+   cannot be allocated, all transfers use PIO. */
+static void
+init_bus_master (void)
+{
+  int dev, func;
+  size_t chan_no;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t class, bar4;
+
+        if ((pci_read_config (dev, func, 0x00) & 0xffff) == 0xffff)
+          continue;
+
+        /* Class 1 (mass storage), subclass 1 (IDE), with bit 7 of
+           the programming interface set if it can bus master.
+           The bus master registers are in I/O space at BAR 4. */
+        class = pci_read_config (dev, func, 0x08);
+        bar4 = pci_read_config (dev, func, 0x20);
+        if ((class >> 16) != 0x0101 || (class & 0x8000) == 0
+            || (bar4 & 1) == 0)
+          continue;
+
+        /* Enable I/O space access and bus mastering. */
+        pci_write_config (dev, func, 0x04,
+                          (pci_read_config (dev, func, 0x04) & 0xffff)
+                          | 0x05);
+
+        for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+          {
+            struct channel *c = &channels[chan_no];
+            c->prdt = palloc_get_page (0);
+            c->bm_base = c->prdt != NULL ? (bar4 & 0xfffc) + chan_no * 8 : 0;
+          }
+        return;
+      }
+}
+
 /* Disk detection and identification. */
 
 static char *descramble_ata_string (char *, int size);
@@ -279,7 +440,7 @@ identify_ata_device (struct ata_disk *d)
       d->is_ata = false;
       return;
     }
-  input_sector (c, id);
+  input_sectors (c, id, 1);
 
   /* Calculate capacity.
      Read model name and serial number. */
@@ -303,6 +464,12 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Word 47 holds the most sectors the disk can transfer per
+     READ/WRITE MULTIPLE block, and bit 8 of word 49 says whether
+     it supports DMA. */
+  set_multiple_mode (d, *(uint16_t *) &id[47 * 2] & 0xff);
+  d->dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x100) != 0;
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
@@ -337,6 +504,484 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
+/* Tells disk D to transfer MULTIPLE_CNT sectors per data block
+   in READ/WRITE MULTIPLE commands.  If MULTIPLE_CNT is less than
+   2 or the disk rejects it, D keeps using one command per
+   sector. */
+static void
+set_multiple_mode (struct ata_disk *d, int multiple_cnt)
+{
+  struct channel *c = d->channel;
+
+  d->multiple_cnt = 1;
+  if (multiple_cnt < 2)
+    return;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), multiple_cnt);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_alt_status (c)) & STA_ERR) == 0)
+    d->multiple_cnt = multiple_cnt;
+}
+
+/* Request queuing.
+
+   Each disk keeps its pending requests on two lists: QUEUE, in
+   ascending order by sector, and FIFO, in order of arrival.
+   Whenever a channel goes idle, start_next() picks the next
+   request for one of its disks in C-SCAN order, that is, the
+   first one at or past the disk's head position, wrapping
+   around to the lowest sector, unless the oldest request has
+   waited past its deadline, in which case that one goes first.
+   Requests that follow the chosen one on disk and go in the
+   same direction are merged into a single command of up to
+   MAX_XFER_SECTORS sectors.
+
+   The queues and the command state in struct channel are
+   shared with the interrupt handler, so they are only touched
+   with interrupts off.  Starting a command means polling the
+   disk until it is ready, which can take milliseconds, so it is
+   never done in the interrupt handler.  A thread claims an idle
+   channel by choosing its next batch with interrupts off, which
+   sets BUSY_DISK, and then issues the command with interrupts
+   on.  ide_submit() does that itself if the channel is idle.
+   When a command completes, the interrupt handler just wakes
+   the channel's starter thread to issue the next one. */
+
+/* Timer ticks that a read or a write may wait before it is
+   served ahead of the elevator order.  Reads usually have a
+   thread waiting for them, so they expire sooner. */
+#define READ_EXPIRE (TIMER_FREQ / 10)
+#define WRITE_EXPIRE (TIMER_FREQ / 2)
+
+/* Returns true if request A starts at a lower sector than
+   request B. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request, elem);
+  const struct block_request *b = list_entry (b_, struct block_request, elem);
+
+  return a->sector < b->sector;
+}
+
+/* Queues request R for disk D, starting it right away if D's
+   channel is idle. */
+static void
+ide_submit (void *d_, struct block_request *r)
+{
+  struct ata_disk *d = d_;
+  enum intr_level old_level;
+
+  ASSERT (r->cnt > 0 && r->cnt <= MAX_XFER_SECTORS);
+
+  r->deadline = timer_ticks () + (r->write ? WRITE_EXPIRE : READ_EXPIRE);
+
+  old_level = intr_disable ();
+  list_insert_ordered (&d->queue, &r->elem, request_less, NULL);
+  list_push_back (&d->fifo, &r->fifo_elem);
+  intr_set_level (old_level);
+
+  if (intr_context ())
+    sema_up (&d->channel->start_sema);
+  else
+    start_next (d->channel);
+}
+
+/* Returns true if BUFFER can be the target of a DMA transfer
+   to or from disk D: D must be on a bus master channel and
+   BUFFER must be a word-aligned kernel address, which the
+   kernel maps to physically contiguous memory. */
+static bool
+can_dma (const struct ata_disk *d, const void *buffer)
+{
+  return (d->dma && is_kernel_vaddr (buffer)
+          && ((uintptr_t) buffer & 1) == 0);
+}
+
+/* Returns the request in disk D's nonempty queue to serve
+   next. */
+static struct block_request *
+choose_request (struct ata_disk *d)
+{
+  struct block_request *oldest;
+  struct list_elem *e;
+
+  oldest = list_entry (list_front (&d->fifo), struct block_request, fifo_elem);
+  if (timer_ticks () >= oldest->deadline)
+    return oldest;
+
+  for (e = list_begin (&d->queue); e != list_end (&d->queue);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->sector >= d->head_pos)
+        return r;
+    }
+  return list_entry (list_front (&d->queue), struct block_request, elem);
+}
+
+/* If channel C is idle, starts a command for its next queued
+   request, together with the requests that can be merged with
+   it.  If the command in progress on C failed and must be
+   reissued, does that instead.  Otherwise, does nothing.  Must
+   not be called in interrupt context. */
+static void
+start_next (struct channel *c)
+{
+  enum intr_level old_level;
+  bool start;
+
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  if (c->busy_disk == NULL)
+    start = choose_batch (c);
+  else
+    {
+      start = c->retry;
+      c->retry = false;
+    }
+  intr_set_level (old_level);
+
+  if (start)
+    start_batch (c);
+}
+
+/* Claims idle channel C for a batch made of its next queued
+   request and the requests that can be merged with it.  Returns
+   true if successful, false if no requests are queued.
+   Interrupts must be off. */
+static bool
+choose_batch (struct channel *c)
+{
+  struct ata_disk *d = NULL;
+  struct block_request *r;
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (c->busy_disk == NULL);
+
+  /* Take turns between the channel's two disks. */
+  for (i = 0; i < 2 && d == NULL; i++)
+    {
+      struct ata_disk *cand = &c->devices[(c->next_dev + i) % 2];
+      if (!list_empty (&cand->queue))
+        d = cand;
+    }
+  if (d == NULL)
+    return false;
+  c->next_dev = !d->dev_no;
+
+  r = choose_request (d);
+  c->batch_sector = r->sector;
+  c->batch_cnt = 0;
+  c->batch_write = r->write;
+  c->batch_dma = true;
+  for (;;)
+    {
+      struct list_elem *next = list_remove (&r->elem);
+      list_remove (&r->fifo_elem);
+      list_push_back (&c->batch, &r->elem);
+      c->batch_cnt += r->cnt;
+      c->batch_dma = c->batch_dma && can_dma (d, r->buffer);
+
+      if (next == list_end (&d->queue))
+        break;
+      r = list_entry (next, struct block_request, elem);
+      if (r->write != c->batch_write
+          || r->sector != c->batch_sector + c->batch_cnt
+          || c->batch_cnt + r->cnt > MAX_XFER_SECTORS)
+        break;
+    }
+
+  c->busy_disk = d;
+  d->head_pos = c->batch_sector + c->batch_cnt;
+  return true;
+}
+
+/* Thread function for channel C's starter thread, which starts
+   commands on C's behalf when the interrupt handler cannot. */
+static void
+starter (void *c_)
+{
+  struct channel *c = c_;
+
+  for (;;)
+    {
+      sema_down (&c->start_sema);
+      start_next (c);
+    }
+}
+
+/* Fills in channel C's PRD table to describe the buffers of the
+   command in progress.  Each buffer is physically contiguous, so
+   it needs one region plus one more per 64 kB boundary that it
+   crosses. */
+static void
+build_prdt (struct channel *c)
+{
+  struct prd *prd = c->prdt;
+  struct list_elem *e;
+
+  for (e = list_begin (&c->batch); e != list_end (&c->batch);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      const uint8_t *p = r->buffer;
+      size_t left = r->cnt * BLOCK_SECTOR_SIZE;
+
+      while (left > 0)
+        {
+          uintptr_t phys = vtop (p);
+          size_t size = 0x10000 - (phys & 0xffff);
+          if (size > left)
+            size = left;
+          prd->addr = phys;
+          prd->size = size & 0xffff;
+          prd->flags = 0;
+          prd++;
+          p += size;
+          left -= size;
+        }
+    }
+  prd[-1].flags = PRD_EOT;
+}
+
+/* Moves the next block of the PIO command in progress on
+   channel C, at most multiple_cnt sectors, between the disk and
+   the requests' buffers. */
+static void
+pio_move (struct channel *c)
+{
+  size_t n = c->busy_disk->multiple_cnt;
+
+  if (n > c->pio_left)
+    n = c->pio_left;
+  c->pio_left -= n;
+  while (n-- > 0)
+    {
+      struct block_request *r = list_entry (c->pio_req,
+                                            struct block_request, elem);
+      uint8_t *p = (uint8_t *) r->buffer + c->pio_ofs * BLOCK_SECTOR_SIZE;
+
+      if (c->batch_write)
+        output_sectors (c, p, 1);
+      else
+        input_sectors (c, p, 1);
+      if (++c->pio_ofs == r->cnt)
+        {
+          c->pio_req = list_next (c->pio_req);
+          c->pio_ofs = 0;
+        }
+    }
+}
+
+/* Issues the command set up in channel C by choose_batch().
+   Called with interrupts on, but C must be claimed, so that
+   nothing else touches its command state until the command is
+   issued. */
+static void
+start_batch (struct channel *c)
+{
+  struct ata_disk *d = c->busy_disk;
+  bool write = c->batch_write;
+
+  select_sector (d, c->batch_sector, c->batch_cnt);
+  if (c->batch_dma)
+    {
+      uint8_t direction = write ? 0 : BM_CMD_READ;
+
+      build_prdt (c);
+      outl (reg_bm_prdt (c), vtop (c->prdt));
+      outb (reg_bm_command (c), direction);
+      outb (reg_bm_status (c), BM_STA_ERROR | BM_STA_INTR);
+      outb (reg_command (c), write ? CMD_WRITE_DMA : CMD_READ_DMA);
+      outb (reg_bm_command (c), direction | BM_CMD_START);
+    }
+  else
+    {
+      c->pio_left = c->batch_cnt;
+      c->pio_req = list_begin (&c->batch);
+      c->pio_ofs = 0;
+      if (d->multiple_cnt > 1)
+        outb (reg_command (c), write ? CMD_WRITE_MULTIPLE : CMD_READ_MULTIPLE);
+      else
+        outb (reg_command (c),
+              write ? CMD_WRITE_SECTOR_RETRY : CMD_READ_SECTOR_RETRY);
+
+      /* The first block of a write goes out without waiting for
+         an interrupt.  The disk interrupts as soon as it has the
+         block, so move it with interrupts off. */
+      if (write)
+        {
+          enum intr_level old_level;
+
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, c->batch_sector);
+          old_level = intr_disable ();
+          pio_move (c);
+          intr_set_level (old_level);
+        }
+    }
+}
+
+/* Handles an interrupt from channel C for the command in
+   progress.  Once the command is done, wakes C's starter thread
+   to start the next one and then calls the completion function
+   of each request that the finished command served. */
+static void
+command_interrupt (struct channel *c)
+{
+  struct ata_disk *d = c->busy_disk;
+  struct list done;
+  uint8_t status;
+
+  status = inb (reg_status (c));        /* Acknowledge interrupt. */
+  if (c->batch_dma)
+    {
+      uint8_t bm_status;
+
+      outb (reg_bm_command (c), c->batch_write ? 0 : BM_CMD_READ);
+      bm_status = inb (reg_bm_status (c));
+      outb (reg_bm_status (c), BM_STA_ERROR | BM_STA_INTR);
+      if ((bm_status & BM_STA_ERROR) != 0 || (status & STA_ERR) != 0)
+        {
+          printf ("%s: DMA %s failed, sector=%"PRDSNu"; "
+                  "falling back to PIO\n",
+                  d->name, c->batch_write ? "write" : "read",
+                  c->batch_sector);
+          d->dma = false;
+          c->batch_dma = false;
+          c->retry = true;
+          sema_up (&c->start_sema);
+          return;
+        }
+    }
+  else
+    {
+      if ((status & STA_ERR) != 0)
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu, d->name,
+               c->batch_write ? "write" : "read", c->batch_sector);
+
+      /* Each interrupt during a read announces a block of data
+         to fetch.  During a write, it acknowledges the block
+         just sent, so send the next one, if any. */
+      if (!c->batch_write)
+        pio_move (c);
+      else if (c->pio_left > 0)
+        {
+          pio_move (c);
+          return;
+        }
+      if (c->pio_left > 0)
+        return;
+    }
+
+  list_init (&done);
+  list_splice (list_end (&done), list_begin (&c->batch), list_end (&c->batch));
+  c->busy_disk = NULL;
+  if (!list_empty (&c->devices[0].queue) || !list_empty (&c->devices[1].queue))
+    sema_up (&c->start_sema);
+
+  while (!list_empty (&done))
+    {
+      struct block_request *r = list_entry (list_pop_front (&done),
+                                            struct block_request, elem);
+      r->complete (r);
+    }
+}
+
+/* Completion function for the requests queued by
+   ide_transfer(). */
+static void
+wake_submitter (struct block_request *r)
+{
+  sema_up (r->aux);
+}
+
+/* Transfers CNT sectors between disk D starting at SEC_NO and
+   BUFFER, as ide_read_multiple() or ide_write_multiple(), by
+   queuing requests and waiting for them to complete. */
+static void
+ide_transfer (struct ata_disk *d, block_sector_t sec_no, const void *buffer,
+              size_t cnt, bool write)
+{
+  uint8_t sector_buf[BLOCK_SECTOR_SIZE];
+  uint8_t *bounce = NULL;
+  size_t max_cnt = MAX_XFER_SECTORS;
+  const uint8_t *p = buffer;
+  struct block_request r;
+  struct semaphore done;
+
+  /* Data moves in interrupt context, while some other process's
+     page directory may be active, so a user buffer is bounced
+     through kernel memory. */
+  if (!is_kernel_vaddr (buffer))
+    {
+      bounce = palloc_get_page (0);
+      max_cnt = PGSIZE / BLOCK_SECTOR_SIZE;
+      if (bounce == NULL)
+        {
+          bounce = sector_buf;
+          max_cnt = 1;
+        }
+    }
+
+  sema_init (&done, 0);
+  while (cnt > 0)
+    {
+      size_t n = cnt < max_cnt ? cnt : max_cnt;
+      size_t size = n * BLOCK_SECTOR_SIZE;
+
+      r.sector = sec_no;
+      r.cnt = n;
+      r.buffer = bounce != NULL ? bounce : (void *) p;
+      r.write = write;
+      r.complete = wake_submitter;
+      r.aux = &done;
+      if (bounce != NULL && write)
+        memcpy (bounce, p, size);
+      ide_submit (d, &r);
+      sema_down (&done);
+      if (bounce != NULL && !write)
+        memcpy ((void *) p, bounce, size);
+
+      p += size;
+      sec_no += n;
+      cnt -= n;
+    }
+
+  if (bounce != NULL && bounce != sector_buf)
+    palloc_free_page (bounce);
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read_multiple (void *d_, block_sector_t sec_no, void *buffer, size_t cnt)
+{
+  ide_transfer (d_, sec_no, buffer, cnt, false);
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes.  Returns
+   after the disk has acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write_multiple (void *d_, block_sector_t sec_no, const void *buffer,
+                    size_t cnt)
+{
+  ide_transfer (d_, sec_no, buffer, cnt, true);
+}
+
 /* Reads sector SEC_NO from disk D into BUFFER, which must have
    room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to disks, so external
@@ -344,16 +989,7 @@ descramble_ata_string (char *string, int size)
 static void
 ide_read (void *d_, block_sector_t sec_no, void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  ide_transfer (d_, sec_no, buffer, 1, false);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -364,36 +1000,31 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
 static void
 ide_write (void *d_, block_sector_t sec_no, const void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  ide_transfer (d_, sec_no, buffer, 1, true);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    ide_submit
   };
-
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the sector count CNT to the disk's sector
+   selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_XFER_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_XFER_SECTORS ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -414,20 +1045,21 @@ issue_pio_command (struct channel *c, uint8_t command)
   outb (reg_command (c), command);
 }
 
-/* Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
+/* Reads CNT sectors from channel C's data register in PIO mode
+   into SECTORS, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-input_sector (struct channel *c, void *sector) 
+input_sectors (struct channel *c, void *sectors, size_t cnt) 
 {
-  insw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  insw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain BLOCK_SECTOR_SIZE bytes. */
+/* Writes SECTORS to channel C's data register in PIO mode.
+   SECTORS must contain CNT * BLOCK_SECTOR_SIZE bytes. */
 static void
-output_sector (struct channel *c, const void *sector) 
+output_sectors (struct channel *c, const void *sectors, size_t cnt) 
 {
-  outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  outsw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
 /* Low-level ATA primitives. */
@@ -489,7 +1121,7 @@ select_device (const struct ata_disk *d)
     dev |= DEV_DEV;
   outb (reg_device (c), dev);
   inb (reg_alt_status (c));
-  timer_nsleep (400);
+  timer_ndelay (400);
 }
 
 /* Select disk D in its channel, as select_device(), but wait for
@@ -511,7 +1143,9 @@ interrupt_handler (struct intr_frame *f)
   for (c = channels; c < channels + CHANNEL_CNT; c++)
     if (f->vec_no == c->irq)
       {
-        if (c->expecting_interrupt) 
+        if (c->busy_disk != NULL)
+          command_interrupt (c);
+        else if (c->expecting_interrupt) 
           {
             inb (reg_status (c));               /* Acknowledge interrupt. */
             sema_up (&c->completion_wait);      /* Wake up waiter. */
@@ -20,10 +20,61 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* If true, the idle thread stops the periodic timer interrupt
+   until the next timer expires.
+   Controlled by kernel command-line option "-tickless". */
+bool timer_tickless;
+
+/* PIT cycles per timer tick, and the most ticks a one-shot
+   count in the PIT's 16-bit counter can span. */
+#define TICK_CYCLES ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+#define MAX_IDLE_TICKS (UINT16_MAX / TICK_CYCLES)
+
+/* Tickless idle state.  While ONESHOT is true, the PIT counts
+   down once, ONESHOT_FIRST cycles to the end of the tick that
+   was in progress plus a whole tick for each of the other
+   ONESHOT_TICKS - 1 ticks, instead of interrupting every tick. */
+static bool oneshot;
+static int oneshot_ticks;
+static uint16_t oneshot_first;
+
+/* Number of ticks accounted without a timer interrupt. */
+static int64_t skipped_ticks;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Hierarchical timer wheel holding the armed timers.
+
+   Level L has WHEEL_SIZE slots, each covering WHEEL_SIZE**L
+   ticks, so that together the levels cover WHEEL_SIZE**WHEEL_LEVELS
+   ticks ahead of wheel_ticks.  A timer goes into the lowest level
+   that reaches its expiry.  Each tick, the level-0 slot for that
+   tick is run; whenever the slots of a level wrap around, the next
+   slot of the level above is emptied and its timers are inserted
+   again, now in a lower level.  A timer is thus moved at most
+   WHEEL_LEVELS times, and the work per tick does not depend on
+   how many timers are armed, only on how many expire.  Timers
+   further ahead than the wheel reaches wait in the last slot of
+   the top level and are reinserted from there.
+
+   Accessed only with interrupts off. */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+static struct list wheel[WHEEL_LEVELS][WHEEL_SIZE];
+
+/* Next tick whose level-0 slot will run. */
+static int64_t wheel_ticks;
+
+static void wheel_insert (struct timer *);
+static void wheel_cascade (int level);
+static void run_timers (void);
+static void advance_tick (void);
+static timer_func wake_thread;
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
@@ -35,6 +86,12 @@ static void real_time_delay (int64_t num, int32_t denom);
 void
 timer_init (void) 
 {
+  int level, slot;
+
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SIZE; slot++)
+      list_init (&wheel[level][slot]);
+
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -85,15 +142,23 @@ timer_elapsed (int64_t then)
 }
 
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
-   be turned on. */
+   be turned on.  The thread is blocked until a timer wakes it,
+   so it uses no CPU time meanwhile. */
 void
 timer_sleep (int64_t ticks) 
 {
-  int64_t start = timer_ticks ();
+  struct timer timer;
+  enum intr_level old_level;
 
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks) 
-    thread_yield ();
+  if (ticks <= 0)
+    return;
+
+  timer_setup (&timer, wake_thread, thread_current ());
+  old_level = intr_disable ();
+  timer_arm (&timer, ticks);
+  thread_block ();
+  intr_set_level (old_level);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -164,14 +229,280 @@ void
 timer_print_stats (void) 
 {
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+  if (timer_tickless)
+    printf ("Timer: %"PRId64" ticks skipped while idle\n", skipped_ticks);
+}
+
+/* Called by the idle thread, with interrupts off, just before it
+   halts.  If tickless idle is enabled and no timer expires at the
+   next tick, switches the PIT to a one-shot count that ends at
+   the tick when the next timer expires, or as far ahead as the
+   PIT can count.  timer_resume() accounts for the ticks that
+   passed and restores the periodic interrupt. */
+void
+timer_idle (void)
+{
+  bool output;
+  int skip;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!timer_tickless || oneshot)
+    return;
+
+  /* Count the ticks until one with timers to run, stopping at
+     a wheel cascade, whose timers could be due soon. */
+  for (skip = 1; skip < MAX_IDLE_TICKS; skip++)
+    {
+      int64_t tick = ticks + skip;
+      if ((tick & WHEEL_MASK) == 0
+          || !list_empty (&wheel[0][tick & WHEEL_MASK]))
+        break;
+    }
+  if (skip < 2)
+    return;
+
+  oneshot = true;
+  oneshot_ticks = skip;
+  oneshot_first = pit_read_channel (0, &output);
+  pit_start_oneshot (0, oneshot_first + (skip - 1) * TICK_CYCLES);
+}
+
+/* Called on every external interrupt, in the interrupt context.
+   If the PIT is counting down a one-shot started by timer_idle(),
+   accounts for the ticks that passed and restores the periodic
+   timer interrupt. */
+void
+timer_resume (void)
+{
+  uint16_t count;
+  bool expired;
+  int elapsed;
+
+  ASSERT (intr_context ());
+
+  if (!oneshot)
+    return;
+  oneshot = false;
+
+  count = pit_read_channel (0, &expired);
+  if (expired)
+    {
+      /* The timer interrupt that ended the one-shot is either
+         this one or pending, and it will account for the last
+         tick itself. */
+      elapsed = oneshot_ticks - 1;
+    }
+  else
+    {
+      int cycles = oneshot_first + (oneshot_ticks - 1) * TICK_CYCLES - count;
+      elapsed = (cycles < oneshot_first
+                 ? 0 : 1 + (cycles - oneshot_first) / TICK_CYCLES);
+    }
+  pit_configure_channel (0, 2, TIMER_FREQ);
+
+  skipped_ticks += elapsed;
+  while (elapsed-- > 0)
+    advance_tick ();
 }
 
+/* Initializes TIMER to call FUNC with AUX when it expires.
+   The timer is not armed. */
+void
+timer_setup (struct timer *timer, timer_func *func, void *aux)
+{
+  ASSERT (timer != NULL);
+  ASSERT (func != NULL);
+
+  timer->expires = 0;
+  timer->period = 0;
+  timer->func = func;
+  timer->aux = aux;
+  timer->pending = false;
+}
+
+/* Arms TIMER to expire once, TICKS timer ticks from now.  If
+   TIMER was already armed, its previous expiry is forgotten. */
+void
+timer_arm (struct timer *timer, int64_t ticks)
+{
+  enum intr_level old_level = intr_disable ();
+  timer_arm_at (timer, timer_ticks () + ticks);
+  intr_set_level (old_level);
+}
+
+/* Arms TIMER to expire once, when the tick count reaches
+   EXPIRES, or at the next tick if it already has.  If TIMER was
+   already armed, its previous expiry is forgotten. */
+void
+timer_arm_at (struct timer *timer, int64_t expires)
+{
+  enum intr_level old_level = intr_disable ();
+  timer_cancel (timer);
+  timer->expires = expires;
+  timer->period = 0;
+  wheel_insert (timer);
+  intr_set_level (old_level);
+}
+
+/* Arms TIMER to expire every PERIOD timer ticks, starting
+   PERIOD ticks from now, until it is cancelled. */
+void
+timer_arm_periodic (struct timer *timer, int64_t period)
+{
+  enum intr_level old_level;
+
+  ASSERT (period > 0);
+
+  old_level = intr_disable ();
+  timer_cancel (timer);
+  timer->expires = timer_ticks () + period;
+  timer->period = period;
+  wheel_insert (timer);
+  intr_set_level (old_level);
+}
+
+/* Disarms TIMER.  Returns true if it was armed, false if it had
+   already expired or was never armed. */
+bool
+timer_cancel (struct timer *timer)
+{
+  enum intr_level old_level = intr_disable ();
+  bool pending = timer->pending;
+
+  if (pending)
+    {
+      list_remove (&timer->elem);
+      timer->pending = false;
+    }
+  intr_set_level (old_level);
+  return pending;
+}
+
+/* Returns true if TIMER is armed. */
+bool
+timer_pending (const struct timer *timer)
+{
+  return timer->pending;
+}
+
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
+{
+  advance_tick ();
+}
+
+/* Advances the tick count by one tick and does that tick's
+   work. */
+static void
+advance_tick (void)
 {
   ticks++;
   thread_tick ();
+  run_timers ();
+}
+
+/* Puts TIMER into the wheel slot for its expiry. */
+static void
+wheel_insert (struct timer *timer)
+{
+  int64_t expires = timer->expires;
+  int64_t delta = expires - wheel_ticks;
+  int level;
+
+  if (delta < 0)
+    {
+      /* Already due: run at the next tick. */
+      expires = wheel_ticks;
+      delta = 0;
+    }
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (delta < (int64_t) 1 << (WHEEL_BITS * (level + 1)))
+      break;
+  if (delta >= (int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+    {
+      /* Too far ahead: park at the end of the wheel. */
+      expires = wheel_ticks + ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    }
+
+  list_push_back (&wheel[level][(expires >> (WHEEL_BITS * level))
+                                & WHEEL_MASK],
+                  &timer->elem);
+  timer->pending = true;
+}
+
+/* Moves the timers in the current slot of LEVEL into lower
+   levels. */
+static void
+wheel_cascade (int level)
+{
+  struct list *slot = &wheel[level][(wheel_ticks >> (WHEEL_BITS * level))
+                                    & WHEEL_MASK];
+  struct list timers;
+
+  list_init (&timers);
+  while (!list_empty (slot))
+    list_push_back (&timers, list_pop_front (slot));
+  while (!list_empty (&timers))
+    wheel_insert (list_entry (list_pop_front (&timers),
+                              struct timer, elem));
+}
+
+/* Runs the timers that expire at or before the current tick. */
+static void
+run_timers (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (wheel_ticks <= ticks)
+    {
+      struct list *slot = &wheel[0][wheel_ticks & WHEEL_MASK];
+      struct list due;
+      int level;
+
+      /* When a level's slots wrap around, bring down the next
+         slot of the level above. */
+      for (level = 1; level < WHEEL_LEVELS; level++)
+        {
+          if ((wheel_ticks & (((int64_t) 1 << (WHEEL_BITS * level)) - 1))
+              != 0)
+            break;
+          wheel_cascade (level);
+        }
+
+      /* Take the due timers out of the wheel before calling them,
+         so that they may re-arm themselves. */
+      list_init (&due);
+      while (!list_empty (slot))
+        list_push_back (&due, list_pop_front (slot));
+      wheel_ticks++;
+
+      while (!list_empty (&due))
+        {
+          struct timer *timer = list_entry (list_pop_front (&due),
+                                            struct timer, elem);
+          timer->pending = false;
+          if (timer->period > 0)
+            {
+              timer->expires += timer->period;
+              wheel_insert (timer);
+            }
+          timer->func (timer->aux);
+        }
+    }
+}
+
+/* Timer function for timer_sleep(): wakes thread T, preempting
+   the running thread if T has a higher priority. */
+static void
+wake_thread (void *t_)
+{
+  struct thread *t = t_;
+
+  thread_unblock (t);
+  if (t->priority > thread_current ()->priority)
+    intr_yield_on_return ();
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -1,14 +1,22 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
+/* If true, the timer interrupt stops while idle.
+   Controlled by kernel command-line option "-tickless". */
+extern bool timer_tickless;
+
 void timer_init (void);
 void timer_calibrate (void);
+void timer_idle (void);
+void timer_resume (void);
 
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
@@ -26,4 +34,31 @@ void timer_ndelay (int64_t nanoseconds);
 
 void timer_print_stats (void);
 
+/* Kernel timers.
+
+   A timer calls a function once a given tick is reached, and
+   then again every PERIOD ticks if it is periodic.  The function
+   runs in the timer interrupt handler, with interrupts off, so
+   it must not sleep; it may call thread_unblock(),
+   intr_yield_on_return(), or re-arm or cancel any timer,
+   including its own. */
+typedef void timer_func (void *aux);
+
+struct timer
+  {
+    struct list_elem elem;      /* Element in a timer wheel slot. */
+    int64_t expires;            /* Tick at which FUNC is called. */
+    int64_t period;             /* Ticks between calls, or 0. */
+    timer_func *func;           /* Function to call. */
+    void *aux;                  /* Argument to FUNC. */
+    bool pending;               /* True while armed. */
+  };
+
+void timer_setup (struct timer *, timer_func *, void *aux);
+void timer_arm (struct timer *, int64_t ticks);
+void timer_arm_at (struct timer *, int64_t expires);
+void timer_arm_periodic (struct timer *, int64_t period);
+bool timer_cancel (struct timer *);
+bool timer_pending (const struct timer *);
+
 #endif /* devices/timer.h */
@@ -1,16 +1,400 @@
 #include "filesys/bufcache.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
-void init_bufcache()
+/* Write-back cache of file system device sectors.
+
+   Every access to fs_device made by the file system goes through
+   this cache.  A sector that is not in the cache is read into a
+   free or evicted entry; modified entries are written back to
+   disk only when they are evicted or when the cache is flushed.
+   Eviction uses the clock algorithm.
+
+   cache_lock protects the mapping from entries to sectors, the
+   pin counts and the clock hand.  Each entry's own lock protects
+   its data and dirty bit.  An entry with a nonzero pin count is
+   in use by some thread and is never chosen for eviction.  A
+   thread may acquire an entry lock while holding cache_lock, but
+   never the other way around.
+
+   Besides eviction, a "flusher" kernel thread writes dirty
+   entries back every BUFCACHE_FLUSH_MS milliseconds, which
+   bounds the data lost in a crash.
+
+   A "readahead" kernel thread loads sectors queued by
+   readahead_sector() in the background, so that a sequential
+   reader finds them cached by the time it gets to them. */
+
+/* A cached sector. */
+struct cache_entry
+  {
+    block_sector_t sector;      /* Sector held, if VALID. */
+    bool valid;                 /* True if the entry holds a sector. */
+    bool dirty;                 /* True if DATA differs from disk. */
+    bool accessed;              /* Used since the clock hand passed? */
+    int pin_cnt;                /* Number of threads using the entry. */
+    struct lock lock;           /* Protects DATA and DIRTY. */
+    uint8_t *data;              /* BLOCK_SECTOR_SIZE bytes. */
+  };
+
+static struct cache_entry cache[MAX_BUFCACHE_SIZE];
+static struct lock cache_lock;
+static struct condition entry_unpinned;  /* Signaled when pin_cnt hits 0. */
+static size_t clock_hand;
+
+/* Statistics. */
+static unsigned long long hit_cnt;       /* # of lookups found in cache. */
+static unsigned long long miss_cnt;      /* # of lookups not in cache. */
+static unsigned long long writeback_cnt; /* # of dirty sectors written. */
+
+/* Sectors waiting to be read ahead, a circular queue. */
+#define READAHEAD_QUEUE_SIZE 64
+static block_sector_t readahead_queue[READAHEAD_QUEUE_SIZE];
+static size_t readahead_head;           /* Index of oldest sector. */
+static size_t readahead_cnt;            /* Number of sectors queued. */
+static struct lock readahead_lock;      /* Protects the queue. */
+static struct condition readahead_ready; /* Signaled when not empty. */
+
+static struct cache_entry *lookup (block_sector_t);
+static struct cache_entry *acquire_entry (block_sector_t, bool need_data);
+static void release_entry (struct cache_entry *, bool dirty);
+static thread_func flush_daemon NO_RETURN;
+static thread_func readahead_daemon NO_RETURN;
+
+/* Initializes the buffer cache. */
+void
+init_bufcache (void)
 {
-  ;
+  size_t page_cnt = DIV_ROUND_UP (MAX_BUFCACHE_SIZE * BLOCK_SECTOR_SIZE,
+                                  PGSIZE);
+  uint8_t *base = palloc_get_multiple (PAL_ASSERT, page_cnt);
+  size_t i;
+
+  lock_init (&cache_lock);
+  cond_init (&entry_unpinned);
+  clock_hand = 0;
+  for (i = 0; i < MAX_BUFCACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      e->valid = false;
+      e->dirty = false;
+      e->accessed = false;
+      e->pin_cnt = 0;
+      lock_init (&e->lock);
+      e->data = base + i * BLOCK_SECTOR_SIZE;
+    }
+
+  lock_init (&readahead_lock);
+  cond_init (&readahead_ready);
+  readahead_head = readahead_cnt = 0;
+  thread_create ("flusher", PRI_DEFAULT, flush_daemon, NULL);
+  thread_create ("readahead", PRI_DEFAULT, readahead_daemon, NULL);
 }
 
-void read_sector(void* dest, block_sector_t sector)
+/* Writes every dirty sector in the cache back to disk.  Each
+   entry is pinned while it is written, so only threads that want
+   that particular sector have to wait for the disk. */
+void
+flush_bufcache (void)
 {
-  ;
+  size_t i;
+
+  for (i = 0; i < MAX_BUFCACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      bool written = false;
+
+      /* Reading the dirty bit without E's lock may miss a write
+         in progress, which the next flush then picks up. */
+      lock_acquire (&cache_lock);
+      if (!e->valid || !e->dirty)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->pin_cnt++;
+      lock_release (&cache_lock);
+
+      lock_acquire (&e->lock);
+      if (e->dirty)
+        {
+          block_write (fs_device, e->sector, e->data);
+          e->dirty = false;
+          written = true;
+        }
+      lock_release (&e->lock);
+
+      lock_acquire (&cache_lock);
+      if (written)
+        writeback_cnt++;
+      if (--e->pin_cnt == 0)
+        cond_signal (&entry_unpinned, &cache_lock);
+      lock_release (&cache_lock);
+    }
 }
-void write_sector(void* src, block_sector_t sector)
+
+/* Reads sector SECTOR into DEST, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+read_sector (void *dest, block_sector_t sector)
 {
-  ;
+  read_sector_at (dest, sector, 0, BLOCK_SECTOR_SIZE);
 }
 
+/* Writes BLOCK_SECTOR_SIZE bytes from SRC to sector SECTOR. */
+void
+write_sector (const void *src, block_sector_t sector)
+{
+  write_sector_at (src, sector, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at byte SECTOR_OFS within sector
+   SECTOR into DEST. */
+void
+read_sector_at (void *dest, block_sector_t sector, int sector_ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (sector_ofs >= 0 && size >= 0);
+  ASSERT (sector_ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = acquire_entry (sector, true);
+  memcpy (dest, e->data + sector_ofs, size);
+  release_entry (e, false);
+}
+
+/* Writes SIZE bytes from SRC into sector SECTOR, starting at
+   byte SECTOR_OFS within the sector.  The sector is only read
+   from disk first if the write does not cover all of it. */
+void
+write_sector_at (const void *src, block_sector_t sector,
+                 int sector_ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (sector_ofs >= 0 && size >= 0);
+  ASSERT (sector_ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = acquire_entry (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + sector_ofs, src, size);
+  release_entry (e, true);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR into DEST,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Cached sectors are copied out of the cache.  Each run of
+   uncached sectors is read from disk straight into DEST with a
+   single multi-sector transfer and is not added to the cache,
+   so a large read neither pays for a copy nor flushes out other
+   cached sectors.  This is safe because a sector that is not in
+   the cache has already had any dirty data written back. */
+void
+read_sectors (void *dest_, block_sector_t sector, size_t cnt)
+{
+  uint8_t *dest = dest_;
+  size_t i = 0;
+
+  while (i < cnt)
+    {
+      size_t run = 0;
+
+      lock_acquire (&cache_lock);
+      while (i + run < cnt && lookup (sector + i + run) == NULL)
+        run++;
+      miss_cnt += run;
+      lock_release (&cache_lock);
+
+      if (run > 0)
+        {
+          block_read_multiple (fs_device, sector + i,
+                               dest + i * BLOCK_SECTOR_SIZE, run);
+          i += run;
+        }
+      else
+        {
+          read_sector (dest + i * BLOCK_SECTOR_SIZE, sector + i);
+          i++;
+        }
+    }
+}
+
+/* Queues SECTOR to be loaded into the cache in the background.
+   The request is dropped if too many are already waiting. */
+void
+readahead_sector (block_sector_t sector)
+{
+  lock_acquire (&readahead_lock);
+  if (readahead_cnt < READAHEAD_QUEUE_SIZE)
+    {
+      size_t tail = (readahead_head + readahead_cnt) % READAHEAD_QUEUE_SIZE;
+      readahead_queue[tail] = sector;
+      readahead_cnt++;
+      cond_signal (&readahead_ready, &readahead_lock);
+    }
+  lock_release (&readahead_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+print_bufcache_stats (void)
+{
+  printf ("Buffer cache: %llu hits, %llu misses, %llu write-backs\n",
+          hit_cnt, miss_cnt, writeback_cnt);
+}
+
+/* Returns the entry holding SECTOR, or a null pointer if SECTOR
+   is not cached.  cache_lock must be held. */
+static struct cache_entry *
+lookup (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < MAX_BUFCACHE_SIZE; i++)
+    if (cache[i].valid && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Advances the clock hand to an entry that may be reused and
+   returns it, or returns a null pointer if every entry is
+   pinned.  cache_lock must be held. */
+static struct cache_entry *
+choose_victim (void)
+{
+  size_t i;
+
+  /* The first sweep clears every accessed bit that it passes, so
+     two sweeps always find an unpinned entry if there is one. */
+  for (i = 0; i < 2 * MAX_BUFCACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % MAX_BUFCACHE_SIZE;
+
+      if (!e->valid)
+        return e;
+      if (e->pin_cnt > 0)
+        continue;
+      if (e->accessed)
+        e->accessed = false;
+      else
+        return e;
+    }
+  return NULL;
+}
+
+/* Returns the entry for SECTOR, pinned and with its lock held,
+   loading it into the cache if necessary.  If NEED_DATA is
+   false, the caller is about to overwrite the whole sector, so
+   a newly loaded entry is not read from disk. */
+static struct cache_entry *
+acquire_entry (block_sector_t sector, bool need_data)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      /* Look the sector up again after every wait, since another
+         thread may have loaded it in the meantime. */
+      e = lookup (sector);
+      if (e != NULL)
+        {
+          hit_cnt++;
+          e->pin_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          return e;
+        }
+
+      e = choose_victim ();
+      if (e != NULL)
+        break;
+      cond_wait (&entry_unpinned, &cache_lock);
+    }
+  miss_cnt++;
+
+  /* E is unpinned, so nobody holds its lock and this cannot
+     block.  Taking it before releasing cache_lock keeps other
+     threads from seeing E before its data is valid.  The old
+     contents are written back while cache_lock is still held, so
+     that nobody can read the old sector from disk first. */
+  lock_acquire (&e->lock);
+  if (e->valid && e->dirty)
+    {
+      block_write (fs_device, e->sector, e->data);
+      writeback_cnt++;
+    }
+  e->sector = sector;
+  e->valid = true;
+  e->dirty = false;
+  e->accessed = false;
+  e->pin_cnt = 1;
+  lock_release (&cache_lock);
+
+  /* Other threads that look SECTOR up now wait on E's lock, so
+     the read need not hold up the rest of the cache. */
+  if (need_data)
+    block_read (fs_device, sector, e->data);
+  return e;
+}
+
+/* Releases entry E obtained from acquire_entry(), marking it
+   dirty if DIRTY is true. */
+static void
+release_entry (struct cache_entry *e, bool dirty)
+{
+  if (dirty)
+    e->dirty = true;
+  e->accessed = true;
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  if (--e->pin_cnt == 0)
+    cond_signal (&entry_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Writes dirty entries back to disk periodically, forever. */
+static void
+flush_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_msleep (BUFCACHE_FLUSH_MS);
+      flush_bufcache ();
+    }
+}
+
+/* Loads the sectors queued by readahead_sector() into the
+   cache, one at a time, forever. */
+static void
+readahead_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+      bool cached;
+
+      lock_acquire (&readahead_lock);
+      while (readahead_cnt == 0)
+        cond_wait (&readahead_ready, &readahead_lock);
+      sector = readahead_queue[readahead_head];
+      readahead_head = (readahead_head + 1) % READAHEAD_QUEUE_SIZE;
+      readahead_cnt--;
+      lock_release (&readahead_lock);
+
+      lock_acquire (&cache_lock);
+      cached = lookup (sector) != NULL;
+      lock_release (&cache_lock);
+      if (!cached)
+        release_entry (acquire_entry (sector, true), false);
+    }
+}
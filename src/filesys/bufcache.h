@@ -1,13 +1,34 @@
 #ifndef FILESYS_BUFCACHE_H
 #define FILESYS_BUFCACHE_H
 
+#include <stdbool.h>
 #include "devices/block.h"
 
+/* Number of sectors held by the buffer cache.
+   May be overridden at build time, e.g. -DMAX_BUFCACHE_SIZE=256. */
+#ifndef MAX_BUFCACHE_SIZE
 #define MAX_BUFCACHE_SIZE 64
+#endif
 
-void init_bufcache();
+/* Milliseconds between background write-backs of dirty sectors.
+   May be overridden at build time, e.g. -DBUFCACHE_FLUSH_MS=5000. */
+#ifndef BUFCACHE_FLUSH_MS
+#define BUFCACHE_FLUSH_MS 1000
+#endif
 
-void read_sector(void* dest, block_sector_t sector);
-void write_sector(void* src, block_sector_t sector);
+void init_bufcache (void);
+void flush_bufcache (void);
 
-#endif
+void read_sector (void *dest, block_sector_t sector);
+void write_sector (const void *src, block_sector_t sector);
+void read_sector_at (void *dest, block_sector_t sector,
+                     int sector_ofs, int size);
+void write_sector_at (const void *src, block_sector_t sector,
+                      int sector_ofs, int size);
+void read_sectors (void *dest, block_sector_t sector, size_t cnt);
+void readahead_sector (block_sector_t sector);
+
+/* Statistics. */
+void print_bufcache_stats (void);
+
+#endif /* filesys/bufcache.h */
@@ -0,0 +1,226 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/* Directory entry cache.
+
+   Remembers the result of looking up a name in a directory,
+   keyed by the directory's inode sector and the name, so that
+   resolving a path whose components were resolved before does
+   not have to search any directory.  Names that were not found
+   are remembered too, as DCACHE_ABSENT.
+
+   dir_lookup() consults the cache before searching a directory
+   and fills it afterward.  dir_add() and dir_remove() invalidate
+   the name they change.  inode_close() purges every name under a
+   removed directory when its last opener closes it, because its
+   sector may then be reused for another directory; until then it
+   may still be searched, e.g. as a process's working directory.
+   A lookup that races with such a change could fill
+   the cache with a stale result after the invalidation, so
+   dcache_fill() drops results obtained before the latest
+   invalidation, as told by the stamp taken beforehand.
+
+   When the cache is full, the least recently used name is
+   evicted.  dcache_lock protects everything here. */
+
+/* A cached name. */
+struct dcache_entry
+  {
+    struct hash_elem hash_elem;         /* Element in dcache_table. */
+    struct list_elem list_elem;         /* Element in lru or free list. */
+    block_sector_t dir;                 /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    block_sector_t sector;              /* Inode sector or DCACHE_ABSENT. */
+  };
+
+static struct dcache_entry entries[MAX_DCACHE_SIZE];
+static struct hash dcache_table;
+static struct list lru_list;            /* Most recently used first. */
+static struct list free_list;           /* Unused entries. */
+static struct lock dcache_lock;
+static unsigned invalidate_cnt;         /* Number of invalidations. */
+
+/* Statistics. */
+static unsigned long long hit_cnt;      /* # of lookups found in cache. */
+static unsigned long long miss_cnt;     /* # of lookups not in cache. */
+
+static hash_hash_func dcache_hash;
+static hash_less_func dcache_less;
+static struct dcache_entry *lookup (block_sector_t dir, const char *name);
+static void remove_entry (struct dcache_entry *);
+
+/* Initializes the directory entry cache. */
+void
+init_dcache (void)
+{
+  size_t i;
+
+  hash_init (&dcache_table, dcache_hash, dcache_less, NULL);
+  list_init (&lru_list);
+  list_init (&free_list);
+  lock_init (&dcache_lock);
+  for (i = 0; i < MAX_DCACHE_SIZE; i++)
+    list_push_back (&free_list, &entries[i].list_elem);
+}
+
+/* Returns a stamp to pass to dcache_fill() for a directory
+   search that is about to start. */
+unsigned
+dcache_stamp (void)
+{
+  unsigned stamp;
+
+  lock_acquire (&dcache_lock);
+  stamp = invalidate_cnt;
+  lock_release (&dcache_lock);
+  return stamp;
+}
+
+/* Looks up NAME in the directory whose inode is in sector DIR.
+   If the cache knows the answer, stores the sector of NAME's
+   inode, or DCACHE_ABSENT if NAME does not exist, in *SECTOR and
+   returns true.  Otherwise, returns false. */
+bool
+dcache_lookup (block_sector_t dir, const char *name, block_sector_t *sector)
+{
+  struct dcache_entry *e;
+
+  lock_acquire (&dcache_lock);
+  e = lookup (dir, name);
+  if (e != NULL)
+    {
+      list_remove (&e->list_elem);
+      list_push_front (&lru_list, &e->list_elem);
+      *sector = e->sector;
+      hit_cnt++;
+    }
+  else
+    miss_cnt++;
+  lock_release (&dcache_lock);
+  return e != NULL;
+}
+
+/* Records that NAME in the directory whose inode is in sector
+   DIR has its inode in SECTOR, or does not exist if SECTOR is
+   DCACHE_ABSENT.  Does nothing if the cache has been invalidated
+   since STAMP was obtained from dcache_stamp(), because the
+   result may then be stale. */
+void
+dcache_fill (block_sector_t dir, const char *name, block_sector_t sector,
+             unsigned stamp)
+{
+  struct dcache_entry *e;
+
+  ASSERT (strlen (name) <= NAME_MAX);
+
+  lock_acquire (&dcache_lock);
+  if (stamp == invalidate_cnt && lookup (dir, name) == NULL)
+    {
+      if (list_empty (&free_list))
+        remove_entry (list_entry (list_back (&lru_list),
+                                  struct dcache_entry, list_elem));
+      e = list_entry (list_pop_front (&free_list),
+                      struct dcache_entry, list_elem);
+      e->dir = dir;
+      strlcpy (e->name, name, sizeof e->name);
+      e->sector = sector;
+      hash_insert (&dcache_table, &e->hash_elem);
+      list_push_front (&lru_list, &e->list_elem);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Forgets what is known about NAME in the directory whose inode
+   is in sector DIR.  Must be called whenever NAME is added to or
+   removed from the directory. */
+void
+dcache_invalidate (block_sector_t dir, const char *name)
+{
+  struct dcache_entry *e;
+
+  lock_acquire (&dcache_lock);
+  invalidate_cnt++;
+  e = lookup (dir, name);
+  if (e != NULL)
+    remove_entry (e);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets every name in the directory whose inode is in sector
+   DIR.  Must be called when a removed DIR is freed. */
+void
+dcache_purge (block_sector_t dir)
+{
+  size_t i;
+
+  lock_acquire (&dcache_lock);
+  invalidate_cnt++;
+  for (i = 0; i < MAX_DCACHE_SIZE; i++)
+    {
+      struct dcache_entry *e = &entries[i];
+      if (e->dir == dir && lookup (dir, e->name) == e)
+        remove_entry (e);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Prints directory entry cache statistics. */
+void
+print_dcache_stats (void)
+{
+  printf ("Directory entry cache: %llu hits, %llu misses\n",
+          hit_cnt, miss_cnt);
+}
+
+/* Returns the entry for NAME in DIR, or a null pointer if there
+   is none.  dcache_lock must be held. */
+static struct dcache_entry *
+lookup (block_sector_t dir, const char *name)
+{
+  struct dcache_entry key;
+  struct hash_elem *e;
+
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dcache_table, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dcache_entry, hash_elem) : NULL;
+}
+
+/* Moves E from the cache to the free list.
+   dcache_lock must be held. */
+static void
+remove_entry (struct dcache_entry *e)
+{
+  hash_delete (&dcache_table, &e->hash_elem);
+  list_remove (&e->list_elem);
+  list_push_back (&free_list, &e->list_elem);
+}
+
+/* Returns a hash value for the entry in E. */
+static unsigned
+dcache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dcache_entry *d = hash_entry (e, struct dcache_entry,
+                                             hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+/* Returns true if the entry in A precedes the one in B. */
+static bool
+dcache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dcache_entry *a = hash_entry (a_, struct dcache_entry,
+                                             hash_elem);
+  const struct dcache_entry *b = hash_entry (b_, struct dcache_entry,
+                                             hash_elem);
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
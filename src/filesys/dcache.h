@@ -0,0 +1,29 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Number of names held by the directory entry cache.
+   May be overridden at build time, e.g. -DMAX_DCACHE_SIZE=1024. */
+#ifndef MAX_DCACHE_SIZE
+#define MAX_DCACHE_SIZE 256
+#endif
+
+/* Sector recorded for a name known not to exist. */
+#define DCACHE_ABSENT ((block_sector_t) -1)
+
+void init_dcache (void);
+
+unsigned dcache_stamp (void);
+bool dcache_lookup (block_sector_t dir, const char *name,
+                    block_sector_t *sector);
+void dcache_fill (block_sector_t dir, const char *name,
+                  block_sector_t sector, unsigned stamp);
+void dcache_invalidate (block_sector_t dir, const char *name);
+void dcache_purge (block_sector_t dir);
+
+/* Statistics. */
+void print_dcache_stats (void);
+
+#endif /* filesys/dcache.h */
@@ -1,10 +1,14 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir 
@@ -21,11 +25,93 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* Hashed directories.
+
+   A hashed directory grows by linear hashing.  Its entries live
+   in buckets of one sector each.  A bucket that fills up gets
+   an overflow bucket chained to it.  Bucket B is found through
+   entry B of the bucket table, which is spread over table
+   sectors listed in the header, the directory's first sector.
+   A name's bucket is its hash modulo LEVEL_CNT, or modulo
+   2 * LEVEL_CNT if the first result is below SPLIT, because
+   those buckets have already been split.  Whenever the entries
+   fill more than 3/4 of the buckets' capacity, bucket SPLIT is
+   split: a new bucket is added at the end of the table and the
+   entries that now hash to it move there.
+
+   A lookup thus reads the header, one table sector and usually
+   a single bucket, however large the directory grows.  Bucket,
+   table and overflow sectors are appended to the directory
+   file as needed and are identified by their index in it. */
+
+/* Entries in one bucket. */
+#define BUCKET_ENTRIES ((BLOCK_SECTOR_SIZE - 2 * sizeof (uint32_t))     \
+                        / sizeof (struct dir_entry))
+
+/* Bucket table entries in one table sector. */
+#define TABLE_ENTRIES (BLOCK_SECTOR_SIZE / sizeof (uint32_t))
+
+/* Table sectors listed in the header. */
+#define HEADER_TABLES (BLOCK_SECTOR_SIZE / sizeof (uint32_t) - 4)
+
+/* Identifies a bucket sector. */
+#define BUCKET_MAGIC 0x4b435442
+
+/* Header of a hashed directory.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct dir_header
+  {
+    uint32_t level_cnt;                 /* Buckets before this round. */
+    uint32_t split;                     /* Next bucket to split. */
+    uint32_t entry_cnt;                 /* Entries in use. */
+    uint32_t table_cnt;                 /* Number of table sectors. */
+    uint32_t tables[HEADER_TABLES];     /* Index of each table sector. */
+  };
+
+/* A bucket of a hashed directory. */
+struct dir_bucket
+  {
+    struct dir_entry entries[BUCKET_ENTRIES];
+    uint32_t next;                      /* Index of overflow bucket, or 0. */
+    uint32_t magic;                     /* BUCKET_MAGIC. */
+  };
+
+static bool hashed_create (block_sector_t, size_t entry_cnt);
+static bool hashed_lookup (const struct dir *, const char *name,
+                           struct dir_entry *, off_t *);
+static bool hashed_add (struct dir *, const struct dir_entry *);
+static void hashed_removed (struct dir *);
+static bool hashed_readdir (struct dir *, struct dir_entry *);
+
+/* Caches of `struct dir's and of sector-sized buffers, which
+   hold hashed directory headers and buckets. */
+static struct kmem_cache dir_cache;
+static struct kmem_cache block_cache;
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  kmem_cache_init (&dir_cache, "dir", sizeof (struct dir), NULL);
+  kmem_cache_init (&block_cache, "dir sector", BLOCK_SECTOR_SIZE, NULL);
+}
+
+/* Returns true if DIR is hashed, false if it is linear. */
+static bool
+is_hashed (const struct dir *dir)
+{
+  return inode_get_dir_format (dir->inode) == DIR_HASHED;
+}
+
+/* Creates a directory in the given SECTOR with space for
+   ENTRY_CNT entries, or with buckets for that many entries if
+   FORMAT is DIR_HASHED.  Returns true if successful, false on
+   failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, size_t entry_cnt, enum dir_format format)
 {
+  if (format == DIR_HASHED)
+    return hashed_create (sector, entry_cnt);
   return inode_create (true, sector, entry_cnt * sizeof (struct dir_entry));
 }
 
@@ -34,7 +120,7 @@ dir_create (block_sector_t sector, size_t entry_cnt)
 struct dir *
 dir_open (struct inode *inode) 
 {
-  struct dir *dir = calloc (1, sizeof *dir);
+  struct dir *dir = kmem_cache_alloc (&dir_cache);
   if (inode != NULL && dir != NULL)
     {
       dir->inode = inode;
@@ -44,7 +130,7 @@ dir_open (struct inode *inode)
   else
     {
       inode_close (inode);
-      free (dir);
+      kmem_cache_free (&dir_cache, dir);
       return NULL; 
     }
 }
@@ -72,7 +158,7 @@ dir_close (struct dir *dir)
   if (dir != NULL)
     {
       inode_close (dir->inode);
-      free (dir);
+      kmem_cache_free (&dir_cache, dir);
     }
 }
 
@@ -98,6 +184,9 @@ lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (is_hashed (dir))
+    return hashed_lookup (dir, name, ep, ofsp);
+
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (e.in_use && !strcmp (name, e.name)) 
@@ -114,19 +203,33 @@ lookup (const struct dir *dir, const char *name,
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   Answers from the directory entry cache when it can. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  block_sector_t dir_sector, sector;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
+  dir_sector = inode_get_inumber (dir->inode);
+  if (strlen (name) > NAME_MAX)
+    sector = DCACHE_ABSENT;
+  else if (!dcache_lookup (dir_sector, name, &sector))
+    {
+      unsigned stamp = dcache_stamp ();
+      lock_acquire (inode_dir_lock (dir->inode));
+      sector = lookup (dir, name, &e, NULL) ? e.inode_sector : DCACHE_ABSENT;
+      lock_release (inode_dir_lock (dir->inode));
+      dcache_fill (dir_sector, name, sector, stamp);
+    }
+
+  if (sector != DCACHE_ABSENT)
   {
-    *inode = inode_open (e.inode_sector);
+    *inode = inode_open (sector);
   }
   else
     *inode = NULL;
@@ -154,10 +257,21 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  lock_acquire (inode_dir_lock (dir->inode));
+
   /* Check that NAME is not in use. */
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
+  if (is_hashed (dir))
+    {
+      e.in_use = true;
+      strlcpy (e.name, name, sizeof e.name);
+      e.inode_sector = inode_sector;
+      success = hashed_add (dir, &e);
+      goto done;
+    }
+
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
      current end-of-file.
@@ -180,6 +294,9 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
     printf("dir_add failed!!\n");
   }
  done:
+  if (success)
+    dcache_invalidate (inode_get_inumber (dir->inode), name);
+  lock_release (inode_dir_lock (dir->inode));
   return success;
 }
 
@@ -197,6 +314,8 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  lock_acquire (inode_dir_lock (dir->inode));
+
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -210,12 +329,16 @@ dir_remove (struct dir *dir, const char *name)
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  if (is_hashed (dir))
+    hashed_removed (dir);
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  lock_release (inode_dir_lock (dir->inode));
   inode_close (inode);
   return success;
 }
@@ -227,15 +350,418 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool found = false;
+
+  lock_acquire (inode_dir_lock (dir->inode));
+  if (is_hashed (dir))
+    found = hashed_readdir (dir, &e);
+  else
+    while (!found
+           && inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+      {
+        dir->pos += sizeof e;
+        found = e.in_use;
+      }
+  lock_release (inode_dir_lock (dir->inode));
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  if (found)
+    strlcpy (name, e.name, NAME_MAX + 1);
+  return found;
+}
+
+/* Hashed directory internals. */
+
+/* Reads SIZE bytes at byte OFS within sector IDX of INODE into
+   BUFFER.  Returns true if successful. */
+static bool
+read_at (struct inode *inode, void *buffer, off_t size, uint32_t idx,
+         off_t ofs)
+{
+  return inode_read_at (inode, buffer, size,
+                        idx * BLOCK_SECTOR_SIZE + ofs) == size;
+}
+
+/* Writes SIZE bytes from BUFFER at byte OFS within sector IDX of
+   INODE.  Returns true if successful. */
+static bool
+write_at (struct inode *inode, const void *buffer, off_t size, uint32_t idx,
+          off_t ofs)
+{
+  return inode_write_at (inode, buffer, size,
+                         idx * BLOCK_SECTOR_SIZE + ofs) == size;
+}
+
+/* Appends the BLOCK_SECTOR_SIZE bytes in DATA to INODE, whose
+   length must be a multiple of BLOCK_SECTOR_SIZE, and returns
+   the index of the new sector, or 0 on failure. */
+static uint32_t
+append_sector (struct inode *inode, const void *data)
+{
+  uint32_t idx = inode_length (inode) / BLOCK_SECTOR_SIZE;
+  return write_at (inode, data, BLOCK_SECTOR_SIZE, idx, 0) ? idx : 0;
+}
+
+/* Appends an empty bucket to INODE and returns its index, or 0
+   on failure. */
+static uint32_t
+append_bucket (struct inode *inode)
+{
+  struct dir_bucket *b = kmem_cache_zalloc (&block_cache);
+  uint32_t idx = 0;
+
+  if (b != NULL)
+    {
+      b->magic = BUCKET_MAGIC;
+      idx = append_sector (inode, b);
+      kmem_cache_free (&block_cache, b);
+    }
+  return idx;
+}
+
+/* Returns the bucket in hashed directory H that NAME belongs
+   to. */
+static uint32_t
+bucket_of (const struct dir_header *h, const char *name)
+{
+  unsigned hash = hash_string (name);
+  uint32_t bucket = hash % h->level_cnt;
+
+  if (bucket < h->split)
+    bucket = hash % (2 * h->level_cnt);
+  return bucket;
+}
+
+/* Returns the sector index of BUCKET in the hashed directory
+   with header H stored in INODE, or 0 on failure. */
+static uint32_t
+bucket_sector (struct inode *inode, const struct dir_header *h,
+               uint32_t bucket)
+{
+  uint32_t idx;
+
+  if (!read_at (inode, &idx, sizeof idx, h->tables[bucket / TABLE_ENTRIES],
+                bucket % TABLE_ENTRIES * sizeof idx))
+    return 0;
+  return idx;
+}
+
+/* Records that BUCKET of the hashed directory with header H in
+   INODE is at sector index IDX, adding a table sector to H if
+   necessary.  Returns true if successful. */
+static bool
+set_bucket_sector (struct inode *inode, struct dir_header *h,
+                   uint32_t bucket, uint32_t idx)
+{
+  uint32_t table = bucket / TABLE_ENTRIES;
+
+  ASSERT (table < HEADER_TABLES);
+  if (table == h->table_cnt)
+    {
+      static const uint32_t zeros[TABLE_ENTRIES];
+      uint32_t table_idx = append_sector (inode, zeros);
+      if (table_idx == 0)
+        return false;
+      h->tables[h->table_cnt++] = table_idx;
+    }
+  return write_at (inode, &idx, sizeof idx, h->tables[table],
+                   bucket % TABLE_ENTRIES * sizeof idx);
+}
+
+/* Creates a hashed directory in SECTOR with enough buckets for
+   ENTRY_CNT entries.  Returns true if successful. */
+static bool
+hashed_create (block_sector_t sector, size_t entry_cnt)
+{
+  struct dir_header *h;
+  struct inode *inode;
+  uint32_t bucket;
+  bool success = false;
+
+  ASSERT (sizeof *h == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct dir_bucket) <= BLOCK_SECTOR_SIZE);
+
+  if (!inode_create (true, sector, 0))
+    return false;
+  inode = inode_open (sector);
+  h = kmem_cache_zalloc (&block_cache);
+  if (inode == NULL || h == NULL)
+    goto done;
+  inode_set_dir_format (inode, DIR_HASHED);
+
+  h->level_cnt = DIV_ROUND_UP (entry_cnt, BUCKET_ENTRIES);
+  if (h->level_cnt == 0)
+    h->level_cnt = 1;
+  else if (h->level_cnt > TABLE_ENTRIES)
+    h->level_cnt = TABLE_ENTRIES;
+
+  /* Write a provisional header first so that it is sector 0. */
+  if (!write_at (inode, h, sizeof *h, 0, 0))
+    goto done;
+  for (bucket = 0; bucket < h->level_cnt; bucket++)
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
+      uint32_t idx = append_bucket (inode);
+      if (idx == 0 || !set_bucket_sector (inode, h, bucket, idx))
+        goto done;
+    }
+  success = write_at (inode, h, sizeof *h, 0, 0);
+
+ done:
+  kmem_cache_free (&block_cache, h);
+  inode_close (inode);
+  return success;
+}
+
+/* Searches hashed directory DIR for NAME, as lookup(). */
+static bool
+hashed_lookup (const struct dir *dir, const char *name,
+               struct dir_entry *ep, off_t *ofsp)
+{
+  struct dir_header *h = kmem_cache_alloc (&block_cache);
+  struct dir_bucket *b = kmem_cache_alloc (&block_cache);
+  bool found = false;
+  uint32_t idx;
+
+  if (h == NULL || b == NULL || !read_at (dir->inode, h, sizeof *h, 0, 0))
+    goto done;
+
+  for (idx = bucket_sector (dir->inode, h, bucket_of (h, name));
+       idx != 0 && !found && read_at (dir->inode, b, sizeof *b, idx, 0);
+       idx = b->next)
+    {
+      size_t i;
+
+      for (i = 0; i < BUCKET_ENTRIES; i++)
+        if (b->entries[i].in_use && !strcmp (name, b->entries[i].name))
+          {
+            if (ep != NULL)
+              *ep = b->entries[i];
+            if (ofsp != NULL)
+              *ofsp = idx * BLOCK_SECTOR_SIZE + i * sizeof *b->entries;
+            found = true;
+            break;
+          }
+    }
+
+ done:
+  kmem_cache_free (&block_cache, b);
+  kmem_cache_free (&block_cache, h);
+  return found;
+}
+
+/* Stores entry E in a free slot of its bucket in the hashed
+   directory with header H in INODE, chaining on an overflow
+   bucket if the bucket is full.  Uses B as scratch space.
+   Returns true if successful. */
+static bool
+insert_entry (struct inode *inode, const struct dir_header *h,
+              const struct dir_entry *e, struct dir_bucket *b)
+{
+  uint32_t idx = bucket_sector (inode, h, bucket_of (h, e->name));
+  uint32_t new_idx;
+
+  while (idx != 0 && read_at (inode, b, sizeof *b, idx, 0))
+    {
+      size_t i;
+
+      for (i = 0; i < BUCKET_ENTRIES; i++)
+        if (!b->entries[i].in_use)
+          return write_at (inode, e, sizeof *e, idx, i * sizeof *e);
+      if (b->next == 0)
+        break;
+      idx = b->next;
+    }
+  if (idx == 0)
+    return false;
+
+  /* Every slot is taken.  Chain on a new bucket. */
+  new_idx = append_bucket (inode);
+  return (new_idx != 0
+          && write_at (inode, e, sizeof *e, new_idx, 0)
+          && write_at (inode, &new_idx, sizeof new_idx, idx,
+                       offsetof (struct dir_bucket, next)));
+}
+
+/* Splits the next bucket of the hashed directory with header H
+   in INODE, moving the entries that now hash to the new bucket.
+   Uses B as scratch space.  Returns true if successful.
+
+   The entries are first copied to the new bucket under an
+   advanced copy of H, and only once they all are there is H
+   advanced and are the originals freed.  On failure, H is left
+   unchanged, so every entry is still found in its old bucket,
+   and the copies already made are freed again so that
+   hashed_readdir() does not see them twice.  The sectors added
+   for the new bucket are simply left unused. */
+static bool
+split_bucket (struct inode *inode, struct dir_header *h,
+              struct dir_bucket *b)
+{
+  struct dir_header *new_h;
+  struct dir_bucket *moved;
+  uint32_t old_bucket = h->split;
+  uint32_t new_bucket = h->level_cnt + h->split;
+  uint32_t idx, new_idx;
+  bool success;
+
+  /* Once the table is full, buckets just grow longer chains. */
+  if (new_bucket >= HEADER_TABLES * TABLE_ENTRIES)
+    return true;
+
+  new_h = kmem_cache_alloc (&block_cache);
+  moved = kmem_cache_alloc (&block_cache);
+  if (new_h == NULL || moved == NULL)
+    {
+      kmem_cache_free (&block_cache, moved);
+      kmem_cache_free (&block_cache, new_h);
+      return false;
+    }
+  memcpy (new_h, h, sizeof *h);
+
+  new_idx = append_bucket (inode);
+  success = (new_idx != 0
+             && set_bucket_sector (inode, new_h, new_bucket, new_idx));
+  if (++new_h->split == new_h->level_cnt)
+    {
+      new_h->level_cnt *= 2;
+      new_h->split = 0;
+    }
+
+  /* Copy the entries that move to the new bucket. */
+  for (idx = bucket_sector (inode, h, old_bucket);
+       idx != 0 && success && read_at (inode, moved, sizeof *moved, idx, 0);
+       idx = moved->next)
+    {
+      size_t i;
+
+      for (i = 0; i < BUCKET_ENTRIES && success; i++)
+        {
+          struct dir_entry *e = &moved->entries[i];
+          if (e->in_use && bucket_of (new_h, e->name) != old_bucket)
+            success = insert_entry (inode, new_h, e, b);
+        }
+    }
+
+  if (success)
+    {
+      /* Switch to the new header and free the originals.  This
+         only rewrites sectors that exist already, so it does not
+         run out of space. */
+      memcpy (h, new_h, sizeof *h);
+      for (idx = bucket_sector (inode, h, old_bucket);
+           idx != 0 && read_at (inode, moved, sizeof *moved, idx, 0);
+           idx = moved->next)
+        {
+          bool changed = false;
+          size_t i;
+
+          for (i = 0; i < BUCKET_ENTRIES; i++)
+            {
+              struct dir_entry *e = &moved->entries[i];
+              if (e->in_use && bucket_of (h, e->name) != old_bucket)
+                {
+                  e->in_use = false;
+                  changed = true;
+                }
+            }
+          if (changed)
+            write_at (inode, moved, sizeof *moved, idx, 0);
+        }
+    }
+  else
+    {
+      /* Free the copies. */
+      for (idx = new_idx;
+           idx != 0 && read_at (inode, moved, sizeof *moved, idx, 0);
+           idx = moved->next)
+        {
+          memset (moved->entries, 0, sizeof moved->entries);
+          write_at (inode, moved, sizeof *moved, idx, 0);
+        }
+    }
+
+  kmem_cache_free (&block_cache, moved);
+  kmem_cache_free (&block_cache, new_h);
+  return success;
+}
+
+/* Adds entry E to hashed directory DIR, splitting a bucket if
+   the directory has become too full.  Returns true if
+   successful. */
+static bool
+hashed_add (struct dir *dir, const struct dir_entry *e)
+{
+  struct dir_header *h = kmem_cache_alloc (&block_cache);
+  struct dir_bucket *b = kmem_cache_alloc (&block_cache);
+  bool success = false;
+
+  if (h != NULL && b != NULL
+      && read_at (dir->inode, h, sizeof *h, 0, 0)
+      && insert_entry (dir->inode, h, e, b))
+    {
+      uint32_t bucket_cnt = h->level_cnt + h->split;
+
+      h->entry_cnt++;
+      success = true;
+      /* A failed split leaves H as it was, and the next addition
+         tries again. */
+      if (h->entry_cnt > bucket_cnt * BUCKET_ENTRIES / 4 * 3)
+        split_bucket (dir->inode, h, b);
+      if (!write_at (dir->inode, h, sizeof *h, 0, 0))
+        success = false;
+    }
+  kmem_cache_free (&block_cache, b);
+  kmem_cache_free (&block_cache, h);
+  return success;
+}
+
+/* Notes in hashed directory DIR's header that an entry has been
+   removed. */
+static void
+hashed_removed (struct dir *dir)
+{
+  uint32_t entry_cnt;
+
+  if (read_at (dir->inode, &entry_cnt, sizeof entry_cnt, 0,
+               offsetof (struct dir_header, entry_cnt)))
+    {
+      entry_cnt--;
+      write_at (dir->inode, &entry_cnt, sizeof entry_cnt, 0,
+                offsetof (struct dir_header, entry_cnt));
+    }
+}
+
+/* Reads the next entry in use in hashed directory DIR into *EP,
+   visiting the bucket sectors in file order.  Returns true if
+   successful, false if there are no more entries. */
+static bool
+hashed_readdir (struct dir *dir, struct dir_entry *ep)
+{
+  while (dir->pos < inode_length (dir->inode))
+    {
+      uint32_t idx = dir->pos / BLOCK_SECTOR_SIZE;
+      size_t slot = dir->pos % BLOCK_SECTOR_SIZE / sizeof *ep;
+
+      /* Skip the header, table sectors and each bucket's tail. */
+      if (slot == 0)
+        {
+          uint32_t magic;
+          if (idx == 0
+              || !read_at (dir->inode, &magic, sizeof magic, idx,
+                           offsetof (struct dir_bucket, magic))
+              || magic != BUCKET_MAGIC)
+            slot = BUCKET_ENTRIES;
+        }
+      if (slot >= BUCKET_ENTRIES)
         {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        } 
+          dir->pos = (idx + 1) * BLOCK_SECTOR_SIZE;
+          continue;
+        }
+
+      if (!read_at (dir->inode, ep, sizeof *ep, idx, slot * sizeof *ep))
+        return false;
+      dir->pos += sizeof *ep;
+      if (ep->in_use)
+        return true;
     }
   return false;
 }
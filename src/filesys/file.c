@@ -1,6 +1,12 @@
 #include "filesys/file.h"
 #include <debug.h>
-#include "threads/malloc.h"
+#include "threads/slab.h"
+
+/* Bounds on the read-ahead window, in bytes.  The window starts
+   at the minimum when a file is first read sequentially and
+   doubles with each further sequential read. */
+#define READAHEAD_MIN (4 * BLOCK_SECTOR_SIZE)
+#define READAHEAD_MAX (32 * BLOCK_SECTOR_SIZE)
 
 /* An open file. */
 struct file 
@@ -8,7 +14,21 @@ struct file
   struct inode *inode;        /* File's inode. */
   off_t pos;                  /* Current position. */
   bool deny_write;            /* Has file_deny_write() been called? */
+  off_t ra_next;              /* Position a sequential read starts at. */
+  off_t ra_window;            /* Read-ahead window size, 0 if random. */
+  off_t ra_end;               /* End of the bytes already read ahead. */
 };
+
+/* Cache of `struct file's. */
+static struct kmem_cache file_cache;
+
+/* Initializes the file module. */
+void
+file_init (void)
+{
+  kmem_cache_init (&file_cache, "file", sizeof (struct file), NULL);
+}
+
 /* Added for project 4 */
 bool
 file_isdir(struct file* file)
@@ -28,18 +48,21 @@ file_inumber(struct file* file)
 struct file *
 file_open (struct inode *inode) 
 {
-  struct file *file = calloc (1, sizeof *file);
+  struct file *file = kmem_cache_alloc (&file_cache);
   if (inode != NULL && file != NULL)
     {
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_window = 0;
+      file->ra_end = 0;
       return file;
     }
   else
     {
       inode_close (inode);
-      free (file);
+      kmem_cache_free (&file_cache, file);
       return NULL; 
     }
 }
@@ -60,7 +83,7 @@ file_close (struct file *file)
     {
       file_allow_write (file);
       inode_close (file->inode);
-      free (file); 
+      kmem_cache_free (&file_cache, file);
     }
 }
 
@@ -71,6 +94,39 @@ file_get_inode (struct file *file)
   return file->inode;
 }
 
+/* Called before FILE reads SIZE bytes at its current position.
+   If the read continues where the previous one left off, grows
+   FILE's read-ahead window and, once less than half a window
+   beyond the read has been fetched, asks for the rest of the
+   window to be read into the buffer cache in the background.
+   Otherwise, closes the window until reads become sequential
+   again. */
+static void
+readahead (struct file *file, off_t size)
+{
+  off_t read_end = file->pos + size;
+  off_t start, end;
+
+  if (file->pos != file->ra_next)
+    {
+      file->ra_window = 0;
+      file->ra_end = 0;
+      return;
+    }
+
+  if (file->ra_window == 0)
+    file->ra_window = READAHEAD_MIN;
+  else if (file->ra_window < READAHEAD_MAX)
+    file->ra_window *= 2;
+
+  if (file->ra_end - read_end >= file->ra_window / 2)
+    return;
+  start = file->ra_end > read_end ? file->ra_end : read_end;
+  end = read_end + file->ra_window;
+  inode_readahead (file->inode, start, end - start);
+  file->ra_end = end;
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at the file's current position.
    Returns the number of bytes actually read,
@@ -79,8 +135,12 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t bytes_read;
+
+  readahead (file, size);
+  bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_read;
+  file->ra_next = file->pos;
   return bytes_read;
 }
 
@@ -4,6 +4,8 @@
 #include "filesys/off_t.h"
 #include "inode.h"
 
+void file_init (void);
+
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
 struct file *file_reopen (struct file *);
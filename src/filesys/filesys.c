@@ -4,6 +4,8 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/bufcache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
@@ -12,6 +14,19 @@
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+/* If true, do_format() gives the new file system extent-based
+   inodes instead of indexed ones.
+   Controlled by kernel command-line option "-extents". */
+bool filesys_extents;
+
+/* If true, do_format() makes the new file system's directories
+   hashed instead of linear.
+   Controlled by kernel command-line option "-hashdirs". */
+bool filesys_hashdirs;
+
+/* Format given to directories created by filesys_create(). */
+static enum dir_format dir_format;
+
 static void do_format (void);
 
 /* Initializes the file system module.
@@ -23,11 +38,26 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  init_bufcache ();
+  init_dcache ();
   inode_init ();
+  file_init ();
+  dir_init ();
   free_map_init ();
 
   if (format) 
     do_format ();
+  else
+    {
+      /* New inodes and directories get the same layout and
+         format as the root directory. */
+      struct inode *root = inode_open (ROOT_DIR_SECTOR);
+      if (root == NULL)
+        PANIC ("can't open root directory");
+      inode_set_default_layout (inode_get_layout (root));
+      dir_format = inode_get_dir_format (root);
+      inode_close (root);
+    }
 
   free_map_open ();
 }
@@ -38,198 +68,147 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+  flush_bufcache ();
 }
 
 
-/* Added for project 4 */
-bool
-filesys_cd (const char* name)
+/* Extracts a file name part from *SRCP into PART, and updates
+   *SRCP so that the next call will return the next file name
+   part.  Returns 1 if successful, 0 at end of string, -1 for a
+   too-long file name part. */
+static int
+get_next_part (char part[NAME_MAX + 1], const char **srcp)
 {
-  struct dir *new_dir = NULL;
-  char* name_cpy = (char*) malloc ( (strlen(name)+1) * sizeof(char));
-  strlcpy(name_cpy, name, strlen(name) + 1);
-   
-  /* RELATIVE DIRECTORY */
-  struct dir *curr = dir_open_root();
-  //if(thread_current() -> cur_dir != NULL)
-  //  curr = thread_current()->cur_dir;
-  char *token_;
-  char* rest_str;
-  for (token_ = strtok_r(name_cpy, "/", &rest_str); token_ != NULL; token_ = strtok_r(NULL, "/", &rest_str))
-  {
-    struct inode *dir_inode = NULL;
-    if(! dir_lookup(curr, token_, &dir_inode)) {
-      dir_close(curr);
-      return NULL;
+  const char *src = *srcp;
+  char *dst = part;
+
+  /* Skip leading slashes.  If it's all slashes, we're done. */
+  while (*src == '/')
+    src++;
+  if (*src == '\0')
+    return 0;
+
+  /* Copy up to NAME_MAX characters from SRC to DST.  Add null
+     terminator. */
+  while (*src != '/' && *src != '\0')
+    {
+      if (dst < part + NAME_MAX)
+        *dst++ = *src;
+      else
+        return -1;
+      src++;
     }
-    struct dir *next = dir_open(dir_inode);
-    if(next == NULL) {
-      dir_close(curr);
-      return NULL;
+  *dst = '\0';
+
+  /* Advance source pointer. */
+  *srcp = src;
+  return 1;
+}
+
+/* Resolves PATH, relative to the current thread's working
+   directory unless it begins with '/'.  Copies PATH's last
+   component into NAME and returns the directory that contains
+   it, which the caller must close.  NAME is set to the empty
+   string if PATH has no components, e.g. if it is "/".
+   Returns a null pointer if a directory along the way does not
+   exist or a component is too long.
+
+   This is the only place that walks paths, so filesys_create(),
+   filesys_open(), filesys_cd() and filesys_remove() all benefit
+   from the directory entry cache behind dir_lookup(). */
+static struct dir *
+resolve_path (const char *path, char name[NAME_MAX + 1])
+{
+  struct thread *t = thread_current ();
+  char part[NAME_MAX + 1];
+  struct dir *dir;
+  int result;
+
+  if (path[0] == '/' || t->cur_dir == NULL)
+    dir = dir_open_root ();
+  else
+    dir = dir_reopen (t->cur_dir);
+
+  name[0] = '\0';
+  while (dir != NULL && (result = get_next_part (part, &path)) != 0)
+    {
+      if (result < 0)
+        {
+          dir_close (dir);
+          return NULL;
+        }
+
+      /* PART is not the last component, so NAME must be a
+         directory to look in. */
+      if (name[0] != '\0')
+        {
+          struct inode *inode;
+          dir_lookup (dir, name, &inode);
+          dir_close (dir);
+          if (inode != NULL && !inode_is_dir (inode))
+            {
+              inode_close (inode);
+              inode = NULL;
+            }
+          dir = dir_open (inode);
+        }
+      strlcpy (name, part, NAME_MAX + 1);
     }
-    
-    dir_close(curr);
-    curr = next;
-  }
-  new_dir = curr;
-  free(name_cpy);
+  return dir;
+}
 
+/* Changes the current thread's working directory to NAME.
+   Returns true if successful, false on failure. */
+bool
+filesys_cd (const char *name)
+{
+  char last[NAME_MAX + 1];
+  struct dir *dir = resolve_path (name, last);
+  struct thread *t = thread_current ();
 
-  if(new_dir == NULL)
+  if (dir != NULL && last[0] != '\0')
+    {
+      struct inode *inode;
+      dir_lookup (dir, last, &inode);
+      dir_close (dir);
+      if (inode != NULL && !inode_is_dir (inode))
+        {
+          inode_close (inode);
+          inode = NULL;
+        }
+      dir = dir_open (inode);
+    }
+  if (dir == NULL)
     return false;
-  
-  if(thread_current() -> cur_dir != NULL) 
-    dir_close(thread_current() -> cur_dir);
-  
-  thread_current()-> cur_dir = new_dir;
+
+  dir_close (t->cur_dir);
+  t->cur_dir = dir;
   return true;
 }
-/* Creates a file named NAME with the given INITIAL_SIZE.
+
+/* Creates a file named NAME with the given INITIAL_SIZE, or a
+   directory if IS_DIR is true.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
    or if internal memory allocation fails. */
 bool
 filesys_create (bool is_dir, const char *name, off_t initial_size) 
 {
-  if(strlen(name) ==0)
-    return false;
   block_sector_t inode_sector = 0;
-  
-  char directory[ strlen(name) ];
-  char file_name[ strlen(name) ];
-
-  char *name_cpy = (char*) malloc( sizeof(char) * (strlen(name) + 1) );
-  memcpy (name_cpy, name, sizeof(char) * (strlen(name) + 1));
-  //relative path handling : start with ./
-
-  // absolute path handling
-  char *dir_str = directory;
-  if(strlen(name) > 0 && name[0] == '/') {
-    if(dir_str) 
-      *dir_str++ = '/';
-  }
-       
-  // tokenize
-  char *token, *p, *last_token = "";
-  for (token = strtok_r(name_cpy, "/", &p); token != NULL; token = strtok_r(NULL, "/", &p))
-  {
-    // append last_token into directory
-    int tl = strlen (last_token);
-    if (dir_str && tl > 0) {
-      memcpy (dir_str, last_token, sizeof(char) * tl);
-      dir_str[tl] = '/';
-      dir_str += tl + 1;
-    }
-    last_token = token;
-    //printf("%s----\n", last_token);
-  }
-         
-  if(dir_str) 
-    *dir_str = '\0';
-  memcpy (file_name, last_token, (strlen(last_token) + 1));
-  free (name_cpy);
-// -----------
-  struct dir *dir;
-  name_cpy = (char*) malloc ( (strlen(name)+1) * sizeof(char));
-  //printf("%s name ----\n", name);
-  strlcpy(name_cpy, name, strlen(name) + 1);
-   
-  struct dir *curr = dir_open_root();
-  
-  /* /user/bin */ 
-  if( (strlen(name) != 0) && (name[0] == '/') )   //ABSOLUTE PATH
-  {
-    char *token_;
-    char* rest_str;
-    for (token_ = strtok_r(name_cpy, "/", &rest_str); token_ != NULL; token_ = strtok_r(NULL, "/", &rest_str))
-    {
-      /* this should be last filename */
-    if(strlen(rest_str) == 0)
-    {
-      //printf("this is the last token\n");
-      break;
-    }
-    struct inode *inode = NULL;
-    if(! dir_lookup(curr, token_, &inode)) {
-      dir_close(curr);
-      return NULL; // such directory not exist
-    }
-             
-    struct dir *next = dir_open(inode);
-    if(next == NULL) {
-      dir_close(curr);
-      return NULL;
-    }
-    dir_close(curr);
-    curr = next;
-    }
-    //printf("filename : %s\,", file_name);
-    dir = curr;
-    free(name_cpy);
-  }
-  else  //RELATIVE PATH
-  {
-    if(thread_current() -> cur_dir != NULL)
-      curr = thread_current() -> cur_dir;
-    char *token_;
-    char* rest_str;
-    for (token_ = strtok_r(name_cpy, "/", &rest_str); token_ != NULL; token_ = strtok_r(NULL, "/", &rest_str))
-    {
-      if(is_dir)
-      {
-      }
-      /* this should be last filename */
-      if(strlen(rest_str) == 0)
-      {
-        //printf("this is the last token\n");
-        break;
-      }
-      struct inode *inode = NULL;
-      if(! dir_lookup(curr, token_, &inode)) {
-        dir_close(curr);
-        return NULL; // such directory not exist
-      }
-             
-      struct dir *next = dir_open(inode);
-      if(next == NULL) {
-        dir_close(curr);
-        return NULL;
-      }
-      dir_close(curr);
-      curr = next;
-    }
-    //printf("filename : %s\,", file_name);
-    dir = curr;
-    free(name_cpy);
-  }
-  
-  //--------------  
-  bool success;
-  if(is_dir) // CREATE a directory by mkdir
-  {
-    //printf("------MAKING DIRECTORY ---- %s\n", name);
-  }
-
-  if(1) // CREATE a file
-  {
-    success = (dir != NULL
+  char file_name[NAME_MAX + 1];
+  struct dir *dir = resolve_path (name, file_name);
+  bool success = (dir != NULL
+                  && file_name[0] != '\0'
                   && free_map_allocate (1, &inode_sector)
-                  && inode_create (is_dir,inode_sector, initial_size)
+                  && (is_dir
+                      ? dir_create (inode_sector, 0, dir_format)
+                      : inode_create (false, inode_sector, initial_size))
                   && dir_add (dir, file_name, inode_sector));
-    if (!success && inode_sector != 0) 
-      free_map_release (inode_sector, 1);
-    
-    struct inode* inode;
-    if(is_dir && dir_lookup(dir, file_name, &inode))
-    {
-    }
-    
-    dir_close (dir);
-    if(!success)
-          ;
-  }
+  if (!success && inode_sector != 0) 
+    free_map_release (inode_sector, 1);
+  dir_close (dir);
 
-   return success;
+  return success;
 }
 
 /* Opens the file with the given NAME.
@@ -240,87 +219,19 @@ filesys_create (bool is_dir, const char *name, off_t initial_size)
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
- 
-  //Added from here
-  char *name_cpy = (char*) malloc( sizeof(char) * (strlen(name) + 1) );
-  memcpy (name_cpy, name, sizeof(char) * (strlen(name) + 1));
-  struct dir *curr = dir_open_root();
-  dir = curr;
-  if( (strlen(name) != 0) && (name[0] == '/') )   //ABSOLUTE PATH
-  {
-    char *token_;
-    char* rest_str;
-    for (token_ = strtok_r(name_cpy, "/", &rest_str); token_ != NULL; token_ = strtok_r(NULL, "/", &rest_str))
-    {
-      /* this should be last filename */
-      if(strlen(rest_str) == 0)
-      {
-        //printf("this is the last token\n");
-        break;
-      }
-      struct inode *inode = NULL;
-      if(! dir_lookup(curr, token_, &inode)) {
-        dir_close(curr);
-        return NULL; // such directory not exist
-      }
-             
-      struct dir *next = dir_open(inode);
-      if(next == NULL) {
-        dir_close(curr);
-        return NULL;
-      }
-      dir_close(curr);
-      curr = next;
-    }
-    //printf("filename : %s\,", file_name);
-    dir = curr;
-    free(name_cpy);
-  }
-  else  //RELATIVE PATH
-  {
-    if(thread_current() -> cur_dir != NULL)
-    {
-      curr = thread_current() -> cur_dir;
-    }
-    char *token_;
-    char* rest_str;
-    for (token_ = strtok_r(name_cpy, "/", &rest_str); token_ != NULL; token_ = strtok_r(NULL, "/", &rest_str))
-    {
-      /* this should be last filename */
-      if(strlen(rest_str) == 0)
-      {
-        //printf("this is the last token\n");
-        break;
-      }
-      struct inode *inode = NULL;
-      if(! dir_lookup(curr, token_, &inode)) {
-        dir_close(curr);
-        return NULL; // such directory not exist
-      }
-             
-      struct dir *next = dir_open(inode);
-      if(next == NULL) {
-        dir_close(curr);
-        return NULL;
-      }
-      dir_close(curr);
-      curr = next;
-    }
-    //printf("filename : %s\,", file_name);
-    dir = curr;
-    free(name_cpy);
-  }
-  
+  char file_name[NAME_MAX + 1];
+  struct dir *dir = resolve_path (name, file_name);
   struct inode *inode = NULL;
 
   if (dir != NULL)
-    dir_lookup (dir, name, &inode);
+    {
+      if (file_name[0] != '\0')
+        dir_lookup (dir, file_name, &inode);
+      else if (name[0] != '\0')
+        inode = inode_reopen (dir_get_inode (dir));
+    }
   dir_close (dir);
-  if(inode == NULL)
-  {
-    //printf("couldn't find inode \n");
-  }
+
   return file_open (inode);
 }
 
@@ -331,20 +242,25 @@ filesys_open (const char *name)
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char file_name[NAME_MAX + 1];
+  struct dir *dir = resolve_path (name, file_name);
+  bool success = (dir != NULL
+                  && file_name[0] != '\0'
+                  && dir_remove (dir, file_name));
   dir_close (dir); 
 
   return success;
 }
-
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
+  inode_set_default_layout (filesys_extents ? INODE_EXTENTS : INODE_INDEXED);
+  dir_format = filesys_hashdirs ? DIR_HASHED : DIR_LINEAR;
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, 16, dir_format))
     PANIC ("root directory creation failed");
   free_map_close ();
   printf ("done.\n");
@@ -11,6 +11,16 @@
 /* Block device that contains the file system. */
 struct block *fs_device;
 
+/* If true, do_format() gives the new file system extent-based
+   inodes instead of indexed ones.
+   Controlled by kernel command-line option "-extents". */
+extern bool filesys_extents;
+
+/* If true, do_format() makes the new file system's directories
+   hashed instead of linear.
+   Controlled by kernel command-line option "-hashdirs". */
+extern bool filesys_hashdirs;
+
 void filesys_init (bool format);
 void filesys_done (void);
 bool filesys_create (bool is_dir, const char *name, off_t initial_size);
@@ -1,13 +1,31 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Changes to the free map are made in memory only, and each
+   sector of the free map file that they touch is marked here
+   until free_map_flush() writes it out. */
+static struct bitmap *dirty_sectors; /* One bit per free map file sector. */
+
+/* Protects free_map and dirty_sectors.  Nothing else in the file
+   system is locked while it is held except the free map file's
+   own inode, so allocation never waits for unrelated I/O. */
+static struct lock free_map_lock;
+
+/* Number of free map bits held by one sector of the free map
+   file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+static void mark_dirty (block_sector_t, size_t cnt);
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
@@ -17,36 +35,108 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  lock_init (&free_map_lock);
+
+  dirty_sectors = bitmap_create (DIV_ROUND_UP (bitmap_size (free_map),
+                                               BITS_PER_SECTOR));
+  if (dirty_sectors == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.  The change reaches the free map file
+   at the next free_map_flush(). */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = bitmap_scan_and_flip_next (free_map, cnt, false);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      mark_dirty (sector, cnt);
+      *sectorp = sector;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+  lock_release (&free_map_lock);
   return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Allocates up to CNT consecutive sectors starting at SECTOR,
+   stopping at the first sector that is already in use.
+   Returns the number of sectors allocated, which is 0 if SECTOR
+   itself is in use or past the end of the device.  The change
+   reaches the free map file at the next free_map_flush(). */
+size_t
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+  size_t run = 0;
+
+  lock_acquire (&free_map_lock);
+  while (run < cnt && sector + run < bitmap_size (free_map)
+         && !bitmap_test (free_map, sector + run))
+    run++;
+  if (run > 0)
+    {
+      bitmap_set_multiple (free_map, sector, run, true);
+      mark_dirty (sector, run);
+    }
+  lock_release (&free_map_lock);
+  return run;
+}
+
+/* Makes CNT sectors starting at SECTOR available for use.  The
+   change reaches the free map file at the next
+   free_map_flush(). */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Writes the sectors of the free map file that have changed
+   since the last flush.  Does nothing until the free map file
+   is open.  Returns true if successful, false if a sector could
+   not be written. */
+bool
+free_map_flush (void)
+{
+  bool success = true;
+  size_t i;
+
+  if (free_map_file == NULL)
+    return true;
+  lock_acquire (&free_map_lock);
+  for (i = 0; i < bitmap_size (dirty_sectors); i++)
+    if (bitmap_test (dirty_sectors, i))
+      {
+        if (bitmap_write_part (free_map, free_map_file,
+                               i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE))
+          bitmap_reset (dirty_sectors, i);
+        else
+          success = false;
+      }
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Marks the free map file sectors holding the bits for CNT
+   sectors starting at SECTOR as needing to be written.
+   free_map_lock must be held. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  if (cnt > 0)
+    bitmap_set_multiple (dirty_sectors, first, last - first + 1, true);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -64,6 +154,7 @@ free_map_open (void)
 void
 free_map_close (void) 
 {
+  free_map_flush ();
   file_close (free_map_file);
 }
 
@@ -82,4 +173,5 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty_sectors, false);
 }
@@ -2,13 +2,22 @@
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/bufcache.h"
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Caches for in-memory inodes and for sector-sized buffers,
+   which hold on-disk inodes and index blocks. */
+static struct kmem_cache inode_cache;
+static struct kmem_cache sector_cache;
+static kmem_ctor_func inode_ctor;
+
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t
@@ -17,14 +26,147 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
+/* Returns the sector holding byte offset POS in the extent
+   list of DISK_INODE, or -1 if the extents do not reach POS. */
+static block_sector_t
+extents_byte_to_sector (const struct inode_disk *disk_inode, off_t pos)
+{
+  block_sector_t index = pos / BLOCK_SECTOR_SIZE;
+  int i;
+
+  for (i = 0; i < NUM_EXTENTS && disk_inode->extents[i].length > 0; i++)
+    {
+      if (index < disk_inode->extents[i].length)
+        return disk_inode->extents[i].start + index;
+      index -= disk_inode->extents[i].length;
+    }
+  return -1;
+}
+
+/* Appends CNT newly allocated, zeroed sectors to the extent list
+   of DISK_INODE.  The last extent is extended in place when the
+   sectors after it are free; otherwise a new extent is started
+   with the longest run up to CNT that free_map_allocate() can
+   find.  Returns true if successful, false if the disk is full
+   or the extent list overflows.  Sectors allocated before a
+   failure stay in the extent list, so extents_release() still
+   frees them. */
+static bool
+extents_append (struct inode_disk *disk_inode, size_t cnt)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  int extent_cnt = 0;
+
+  while (extent_cnt < NUM_EXTENTS
+         && disk_inode->extents[extent_cnt].length > 0)
+    extent_cnt++;
+
+  while (cnt > 0)
+    {
+      block_sector_t start = 0;
+      size_t run = 0;
+      size_t i;
+
+      if (extent_cnt > 0)
+        {
+          struct inode_extent *last = &disk_inode->extents[extent_cnt - 1];
+          start = last->start + last->length;
+          run = free_map_allocate_at (start, cnt);
+          last->length += run;
+        }
+      if (run == 0)
+        {
+          if (extent_cnt == NUM_EXTENTS)
+            return false;
+          for (run = cnt; run > 0; run /= 2)
+            if (free_map_allocate (run, &start))
+              break;
+          if (run == 0)
+            return false;
+          disk_inode->extents[extent_cnt].start = start;
+          disk_inode->extents[extent_cnt].length = run;
+          extent_cnt++;
+        }
+
+      for (i = 0; i < run; i++)
+        write_sector (zeros, start + i);
+      cnt -= run;
+    }
+  return true;
+}
+
+/* Releases every sector in the extent list of DISK_INODE. */
+static void
+extents_release (struct inode_disk *disk_inode)
+{
+  int i;
+
+  for (i = 0; i < NUM_EXTENTS && disk_inode->extents[i].length > 0; i++)
+    free_map_release (disk_inode->extents[i].start,
+                      disk_inode->extents[i].length);
+}
+
+/* Number of sector numbers held by one index block. */
+#define INDEX_CNT (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Returns the level-2 index block at FST_INDEX within INODE's
+   double indirect block.  Both levels are read through the
+   buffer cache the first time they are needed and then kept in
+   INODE until it is closed or grown, so later translations cost
+   no I/O.  Returns a null pointer if memory is short. */
+static block_sector_t *
+get_index_block (struct inode *inode, int fst_index)
+{
+  if (inode->fst_level == NULL)
+    {
+      inode->fst_level = kmem_cache_alloc (&sector_cache);
+      if (inode->fst_level == NULL)
+        return NULL;
+      read_sector (inode->fst_level, inode->data.double_block);
+    }
+  if (inode->snd_levels == NULL)
+    {
+      inode->snd_levels = kmem_cache_zalloc (&sector_cache);
+      if (inode->snd_levels == NULL)
+        return NULL;
+    }
+  if (inode->snd_levels[fst_index] == NULL)
+    {
+      block_sector_t *snd_level = kmem_cache_alloc (&sector_cache);
+      if (snd_level == NULL)
+        return NULL;
+      read_sector (snd_level, inode->fst_level[fst_index]);
+      inode->snd_levels[fst_index] = snd_level;
+    }
+  return inode->snd_levels[fst_index];
+}
+
+/* Frees the index blocks cached by get_index_block(). */
+static void
+drop_index_blocks (struct inode *inode)
+{
+  if (inode->snd_levels != NULL)
+    {
+      size_t i;
+      for (i = 0; i < INDEX_CNT; i++)
+        kmem_cache_free (&sector_cache, inode->snd_levels[i]);
+      kmem_cache_free (&sector_cache, inode->snd_levels);
+      inode->snd_levels = NULL;
+    }
+  kmem_cache_free (&sector_cache, inode->fst_level);
+  inode->fst_level = NULL;
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
+  if (pos < inode->data.length && inode->data.layout == INODE_EXTENTS)
+    return extents_byte_to_sector (&inode->data, pos);
   if (pos < inode->data.length)
   {
     /* original implemntation */
@@ -41,41 +183,151 @@ byte_to_sector (const struct inode *inode, off_t pos)
       index = index - 124;
       int fst_index = index / 128;
       int snd_index = index % 128;
-
-      block_sector_t fst_blocks[128];
-      block_sector_t snd_blocks[128];
-
-      block_read(fs_device, inode->data.double_block, &fst_blocks);
-      
-      block_read(fs_device, fst_blocks[fst_index], &snd_blocks);
-
-      return snd_blocks[snd_index];
-
-      //exit(-1);
+      block_sector_t *snd_level;
+      block_sector_t snd_sector, sector;
+
+      lock_acquire (&inode->index_lock);
+      snd_level = get_index_block (inode, fst_index);
+      if (snd_level != NULL)
+        sector = snd_level[snd_index];
+      lock_release (&inode->index_lock);
+      if (snd_level != NULL)
+        return sector;
+
+      /* Out of memory: look both entries up in the cache. */
+      read_sector_at (&snd_sector, inode->data.double_block,
+                      fst_index * sizeof snd_sector, sizeof snd_sector);
+      read_sector_at (&sector, snd_sector,
+                      snd_index * sizeof sector, sizeof sector);
+      return sector;
     }
   }
   else
     return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'.  open_inodes_lock
+   protects the table and every open inode's open_cnt and
+   loading flag.  The first opener of a sector adds the inode to
+   the table before reading it and signals inode_loaded when it
+   is done; later openers wait for that. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+static struct condition inode_loaded;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
+
+/* Layout given to inodes created by inode_create(). */
+static enum inode_layout default_layout = INODE_INDEXED;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  lock_init (&open_inodes_lock);
+  cond_init (&inode_loaded);
+  ASSERT (INDEX_CNT * sizeof (block_sector_t *) <= BLOCK_SECTOR_SIZE);
+  kmem_cache_init (&inode_cache, "inode", sizeof (struct inode), inode_ctor);
+  kmem_cache_init (&sector_cache, "inode sector", BLOCK_SECTOR_SIZE, NULL);
+}
+
+/* Constructs in-memory inode INODE_, setting up the members that
+   are back in this state whenever an inode is closed. */
+static void
+inode_ctor (void *inode_)
+{
+  struct inode *inode = inode_;
+
+  inode->fst_level = NULL;
+  inode->snd_levels = NULL;
+  rwlock_init (&inode->rwlock);
+  lock_init (&inode->index_lock);
+  lock_init (&inode->dir_lock);
+}
+
+/* Returns a hash value for inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
+}
+
+/* Returns true if inode A's sector precedes inode B's. */
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct inode *a = hash_entry (a_, struct inode, elem);
+  const struct inode *b = hash_entry (b_, struct inode, elem);
+  return a->sector < b->sector;
+}
+
+/* Returns the open inode for SECTOR, or a null pointer if there
+   is none.  open_inodes_lock must be held. */
+static struct inode *
+lookup_open_inode (block_sector_t sector)
+{
+  struct inode key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  return e != NULL ? hash_entry (e, struct inode, elem) : NULL;
 }
 
+/* Makes inode_create() lay out new inodes as LAYOUT. */
+void
+inode_set_default_layout (enum inode_layout layout)
+{
+  default_layout = layout;
+}
+
+/* Returns the layout of INODE's data. */
+enum inode_layout
+inode_get_layout (const struct inode *inode)
+{
+  return inode->data.layout;
+}
+
+/* Returns the directory format recorded in INODE. */
+int
+inode_get_dir_format (const struct inode *inode)
+{
+  return inode->data.dir_format;
+}
+
+/* Records FORMAT as the directory format of INODE. */
+void
+inode_set_dir_format (struct inode *inode, int format)
+{
+  rwlock_acquire_write (&inode->rwlock);
+  inode->data.dir_format = format;
+  write_sector (&inode->data, inode->sector);
+  rwlock_release_write (&inode->rwlock);
+}
+
+static bool create_disk_inode (bool, block_sector_t, off_t);
+
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device, followed by the parts of the free map that changed.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
-inode_create (bool is_dir,block_sector_t sector, off_t length)
+inode_create (bool is_dir, block_sector_t sector, off_t length)
+{
+  bool success = create_disk_inode (is_dir, sector, length);
+  free_map_flush ();
+  return success;
+}
+
+/* Does the work of inode_create(). */
+static bool
+create_disk_inode (bool is_dir,block_sector_t sector, off_t length)
 {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
@@ -86,24 +338,37 @@ inode_create (bool is_dir,block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
-  disk_inode = calloc (1, sizeof *disk_inode);
+  disk_inode = kmem_cache_zalloc (&sector_cache);
   if (disk_inode != NULL)
     {
       size_t sectors = bytes_to_sectors (length);
       disk_inode->is_dir = is_dir;
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
+      disk_inode->layout = default_layout;
+      if (default_layout == INODE_EXTENTS)
+        {
+          if (extents_append (disk_inode, sectors))
+            {
+              write_sector (disk_inode, sector);
+              success = true;
+            }
+          else
+            extents_release (disk_inode);
+          kmem_cache_free (&sector_cache, disk_inode);
+          return success;
+        }
       /*
       if (free_map_allocate (sectors, &disk_inode->start)) 
         {
-          block_write (fs_device, sector, disk_inode);
+          write_sector (disk_inode, sector);
           if (sectors > 0) 
             {
               static char zeros[BLOCK_SECTOR_SIZE];
               size_t i;
               
               for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
+                write_sector (zeros, disk_inode->start + i);
             }
           success = true; 
         }*/
@@ -117,24 +382,24 @@ inode_create (bool is_dir,block_sector_t sector, off_t length)
         {
           if(!free_map_allocate(1, & (disk_inode->data_blocks[i]) ))
           {
-            free(disk_inode);
+            kmem_cache_free (&sector_cache, disk_inode);
             return success;
           }
           static char zeros[BLOCK_SECTOR_SIZE];
-          block_write (fs_device, disk_inode->data_blocks[i], zeros);
+          write_sector (zeros, disk_inode->data_blocks[i]);
         }
        /* 
         i = 0;
         for(; i < sectors; i ++)
         {
           static char zeros[BLOCK_SECTOR_SIZE];
-          block_write (fs_device, disk_inode->data_blocks[i], zeros);
+          write_sector (zeros, disk_inode->data_blocks[i]);
         }*/
         if(sectors <= 124)
         {
-          block_write(fs_device, sector, disk_inode);
+          write_sector (disk_inode, sector);
           success = true;
-          free(disk_inode);
+          kmem_cache_free (&sector_cache, disk_inode);
           return success;
         }
       }
@@ -156,7 +421,7 @@ inode_create (bool is_dir,block_sector_t sector, off_t length)
 
         free_map_allocate(1, &disk_inode->double_block);
         //else
-        //  block_read(fs_device, inode->blocks[inode->direct_index], &level_one);
+        //  read_sector (&level_one, inode->blocks[inode->direct_index]);
             
         int lev_one_index = 0; 
         int lev_two_index = 0;
@@ -170,9 +435,9 @@ inode_create (bool is_dir,block_sector_t sector, off_t length)
             for( lev_two_index = 0; lev_two_index < 128; lev_two_index ++)
             {
               free_map_allocate(1, &level_two[lev_two_index]);
-              block_write(fs_device, level_two[lev_two_index], zeros);
+              write_sector (zeros, level_two[lev_two_index]);
             }
-            block_write(fs_device, level_one[lev_one_index++], &level_two);
+            write_sector (&level_two, level_one[lev_one_index++]);
             num_indirect_blocks --;
           }
           else if(num_indirect_blocks == 1)
@@ -181,22 +446,22 @@ inode_create (bool is_dir,block_sector_t sector, off_t length)
             for( lev_two_index = 0; lev_two_index < num_blocks_at_last; lev_two_index ++)
             {
               free_map_allocate(1, &level_two[lev_two_index]);
-              block_write(fs_device, level_two[lev_two_index], zeros);
+              write_sector (zeros, level_two[lev_two_index]);
             }
-            block_write(fs_device, level_one[lev_one_index++], &level_two);
+            write_sector (&level_two, level_one[lev_one_index++]);
             num_indirect_blocks --;
           }
           else
           {
-            block_write(fs_device, disk_inode->double_block, &level_one);
+            write_sector (&level_one, disk_inode->double_block);
             break;
           }
         //----
         }
-        block_write(fs_device, sector, disk_inode);
+        write_sector (disk_inode, sector);
         success=true;
       }
-      free (disk_inode);
+      kmem_cache_free (&sector_cache, disk_inode);
     }
   return success;
 }
@@ -207,33 +472,47 @@ inode_create (bool is_dir,block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Check whether this inode is already open, and if it is still
+     being read by its first opener, wait for it. */
+  lock_acquire (&open_inodes_lock);
+  inode = lookup_open_inode (sector);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode->open_cnt++;
+      while (inode->loading)
+        cond_wait (&inode_loaded, &open_inodes_lock);
+      lock_release (&open_inodes_lock);
+      return inode;
     }
 
-  /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  /* Allocate memory.  The locks and index block pointers are
+     already set up by inode_ctor(). */
+  inode = kmem_cache_alloc (&inode_cache);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize, and add the inode to open_inodes before reading
+     it, so that nobody else can open the sector meanwhile and
+     end up with a second copy. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->loading = true;
+  hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
+  read_sector (&inode->data, inode->sector);
+
+  lock_acquire (&open_inodes_lock);
+  inode->loading = false;
+  cond_broadcast (&inode_loaded, &open_inodes_lock);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -242,7 +521,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -253,24 +536,39 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
-/* Closes INODE and writes it to disk.
+/* Closes INODE.  Does not write it to disk, because the on-disk
+   inode is already updated whenever INODE grows or changes.
    If this was the last reference to INODE, frees its memory.
    If INODE was also a removed inode, frees its blocks. */
 void
 inode_close (struct inode *inode) 
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
+      /* Forget the names cached under a removed directory before
+         its sector can be reused for a new one. */
+      if (inode->removed && inode->data.is_dir)
+        dcache_purge (inode->sector);
+
       /* Deallocate blocks if removed. */
-      if (inode->removed) 
+      if (inode->removed && inode->data.layout == INODE_EXTENTS)
+        {
+          free_map_release (inode->sector, 1);
+          extents_release (&inode->data);
+        }
+      else if (inode->removed) 
         {
           free_map_release (inode->sector, 1);
           /* Added start free */
@@ -297,30 +595,10 @@ inode_close (struct inode *inode)
             free_map_release(inode->data.double_block, 1);
           }
         }
-      else
-      {
-        struct inode_disk inode_saved;
-        inode_saved.is_dir = inode->data.is_dir;
-        inode_saved.length = inode->data.length;
-        inode_saved.magic = inode->data.magic;
-        inode_saved.double_block = inode->data.double_block;
-        memcpy(&inode_saved.data_blocks, &inode->data.data_blocks, NUM_DBLOCKS* sizeof(block_sector_t));
-        
-        block_write(fs_device, inode->sector, &inode_saved);
-      }
-      free (inode); 
-    }
-    else // when some are opened
-    {
-        struct inode_disk inode_saved;
-        inode_saved.is_dir = inode->data.is_dir;
-        inode_saved.length = inode->data.length;
-        inode_saved.magic = inode->data.magic;
-        inode_saved.double_block = inode->data.double_block;
-        memcpy(&inode_saved.data_blocks, &inode->data.data_blocks, NUM_DBLOCKS* sizeof(block_sector_t));
-        
-        block_write(fs_device, inode->sector, &inode_saved);
- 
+      if (inode->removed)
+        free_map_flush ();
+      drop_index_blocks (inode);
+      kmem_cache_free (&inode_cache, inode);
     }
 }
 
@@ -330,7 +608,9 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  rwlock_acquire_write (&inode->rwlock);
   inode->removed = true;
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -341,8 +621,8 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
+  rwlock_acquire_read (&inode->rwlock);
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -361,21 +641,23 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 
       if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
+          /* Read as many whole sectors as are contiguous on disk
+             with one request, directly into caller's buffer. */
+          int sector_cnt = 1;
+          while (size >= (sector_cnt + 1) * BLOCK_SECTOR_SIZE
+                 && inode_left >= (sector_cnt + 1) * BLOCK_SECTOR_SIZE
+                 && (byte_to_sector (inode,
+                                     offset + sector_cnt * BLOCK_SECTOR_SIZE)
+                     == sector_idx + sector_cnt))
+            sector_cnt++;
+          read_sectors (buffer + bytes_read, sector_idx, sector_cnt);
+          chunk_size = sector_cnt * BLOCK_SECTOR_SIZE;
         }
-      else 
+      else
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          /* Copy the chunk out of the buffer cache. */
+          read_sector_at (buffer + bytes_read, sector_idx, sector_ofs,
+                          chunk_size);
         }
       
       /* Advance. */
@@ -383,11 +665,30 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  rwlock_release_read (&inode->rwlock);
 
   return bytes_read;
 }
+
+/* Asks the buffer cache to prefetch, in the background, the
+   sectors holding the SIZE bytes of INODE that start at OFFSET.
+   Bytes past the end of INODE are ignored. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+
+  rwlock_acquire_read (&inode->rwlock);
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE); offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    readahead_sector (byte_to_sector (inode, offset));
+  rwlock_release_read (&inode->rwlock);
+}
 /* Added for project 4 */
+/* Extends INODE by SIZE bytes.  INODE's rwlock must be held for
+   writing. */
 bool
 inode_grow(struct inode *inode, off_t size)
 {
@@ -396,6 +697,16 @@ inode_grow(struct inode *inode, off_t size)
   off_t cur_len = disk_inode -> length;
   ASSERT (size >= 0);
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+  if (disk_inode->layout == INODE_EXTENTS)
+    {
+      size_t sectors = bytes_to_sectors (cur_len);
+      size_t sectors_needed = bytes_to_sectors (cur_len + size);
+      if (sectors_needed > sectors
+          && !extents_append (disk_inode, sectors_needed - sectors))
+        return false;
+      disk_inode->length = cur_len + size;
+      return true;
+    }
   ASSERT (size + cur_len < 128*128*512 + 124 * 512);
   //disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
@@ -414,21 +725,20 @@ inode_grow(struct inode *inode, off_t size)
         if(disk_inode->data_blocks[i] == 0)
         {
         if(!free_map_allocate(1, & ( (&(inode->data))->data_blocks[i]) ))
-        {
-          free(disk_inode);
           return success;
-        }
         static char zeros[BLOCK_SECTOR_SIZE];
-          block_write (fs_device, disk_inode->data_blocks[i], zeros);
+          write_sector (zeros, disk_inode->data_blocks[i]);
         }
       }
-      //block_write(fs_device, inode->sector, disk_inode);
+      //write_sector (disk_inode, inode->sector);
       success = true;
       //free(disk_inode);
       return success;
     }
     else  // need double block 
     {
+      /* The index blocks are about to change on disk. */
+      drop_index_blocks (inode);
       if(sectors <= 124)
       {
         int i=sectors;
@@ -437,12 +747,9 @@ inode_grow(struct inode *inode, off_t size)
           if(disk_inode->data_blocks[i] == 0)
           {
             if(!free_map_allocate(1, & ( (&(inode->data))->data_blocks[i]) ))
-            {
-              free(disk_inode);
               return success;
-            }
             static char zeros[BLOCK_SECTOR_SIZE];
-            block_write (fs_device, disk_inode->data_blocks[i], zeros);
+            write_sector (zeros, disk_inode->data_blocks[i]);
           }
         }
         sectors = 124;
@@ -467,7 +774,7 @@ inode_grow(struct inode *inode, off_t size)
       block_sector_t snd_level[128];
 
         //else
-        //  block_read(fs_device, inode->blocks[inode->direct_index], &level_one);
+        //  read_sector (&level_one, inode->blocks[inode->direct_index]);
       int fst_lev_index = 0; 
       int snd_lev_index = 0;
        
@@ -485,10 +792,10 @@ inode_grow(struct inode *inode, off_t size)
           fst_lev_index = num_indirect_blocks_alloc; 
           snd_lev_index = num_blocks_at_last_alloc;
         }
-        block_read(fs_device, disk_inode->double_block, &fst_level);
+        read_sector (&fst_level, disk_inode->double_block);
         if(num_blocks_at_last_alloc !=0 )
         {
-          block_read(fs_device, fst_level[fst_lev_index], &snd_level);
+          read_sector (&snd_level, fst_level[fst_lev_index]);
         }
         /* Fill up the last block! */
         if(num_blocks_at_last_alloc != 0)
@@ -501,10 +808,10 @@ inode_grow(struct inode *inode, off_t size)
             for( ; snd_lev_index < num_blocks_at_last; snd_lev_index ++)
             {
               free_map_allocate(1, &snd_level[snd_lev_index]);
-              block_write(fs_device, snd_level[snd_lev_index], zeros);
+              write_sector (zeros, snd_level[snd_lev_index]);
             }
             snd_lev_index = 0;
-            block_write(fs_device, fst_level[fst_lev_index++], &snd_level);
+            write_sector (&snd_level, fst_level[fst_lev_index++]);
           }
           else if(num_indirect_blocks_alloc+1 < num_indirect_blocks)
           {
@@ -513,10 +820,10 @@ inode_grow(struct inode *inode, off_t size)
             for( ; snd_lev_index < 128; snd_lev_index ++)
             {
               free_map_allocate(1, &snd_level[snd_lev_index]);
-              block_write(fs_device, snd_level[snd_lev_index], zeros);
+              write_sector (zeros, snd_level[snd_lev_index]);
             }
             snd_lev_index = 0;
-            block_write(fs_device, fst_level[fst_lev_index++], &snd_level);
+            write_sector (&snd_level, fst_level[fst_lev_index++]);
             //num_indirect_blocks --;
           }
           else
@@ -539,10 +846,10 @@ inode_grow(struct inode *inode, off_t size)
           for(snd_lev_index =0 ; snd_lev_index < 128; snd_lev_index ++)
           {
             free_map_allocate(1, &snd_level[snd_lev_index]);
-            block_write(fs_device, snd_level[snd_lev_index], zeros);
+            write_sector (zeros, snd_level[snd_lev_index]);
           }
           snd_lev_index = 0;
-          block_write(fs_device, fst_level[fst_lev_index++], &snd_level);
+          write_sector (&snd_level, fst_level[fst_lev_index++]);
           num_indirect_blocks --;
         }
           
@@ -554,15 +861,15 @@ inode_grow(struct inode *inode, off_t size)
             if(snd_level[snd_lev_index] == 0)
             {
               free_map_allocate(1, &snd_level[snd_lev_index]);
-              block_write(fs_device, snd_level[snd_lev_index], zeros);
+              write_sector (zeros, snd_level[snd_lev_index]);
             }
           }
-          block_write(fs_device, fst_level[fst_lev_index++], &snd_level);
+          write_sector (&snd_level, fst_level[fst_lev_index++]);
           num_indirect_blocks --;
         }
         else
         {
-          block_write(fs_device, disk_inode->double_block, &fst_level);
+          write_sector (&fst_level, disk_inode->double_block);
           break;
         }
         success=true;
@@ -583,22 +890,37 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool exclusive = false;
   if(inode-> data.is_dir)
   {
     //printf("trying to write %s on directory file \n", buffer);
     //return 0;
   }
+
+  /* Writes within the file share the lock.  A write that extends
+     the file needs it exclusively, and must check again once it
+     has it, since another writer may have grown the file. */
+  rwlock_acquire_read (&inode->rwlock);
+  if (inode_length (inode) - offset < size && !inode->deny_write_cnt)
+  {
+    rwlock_release_read (&inode->rwlock);
+    rwlock_acquire_write (&inode->rwlock);
+    exclusive = true;
+  }
   if (inode->deny_write_cnt)
-    return 0;
+    goto done;
 
   /* If growth needed, then grow */
   if(inode_length(inode) - offset < size)
   {
     if( ! inode_grow(inode, size - (inode_length(inode) - offset)) )
     {
-      return 0;
+      goto done;
     }
+    /* Like inode_set_dir_format(), write the changed inode into
+       the cache right away, so that closing need not rewrite it. */
+    write_sector (&inode->data, inode->sector);
+    free_map_flush ();
   }
   while (size > 0) 
     {
@@ -616,39 +938,22 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      /* Copy the chunk into the buffer cache, which reads the
+         rest of the sector first if the chunk does not cover it. */
+      write_sector_at (buffer + bytes_written, sector_idx, sector_ofs,
+                       chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
 
+ done:
+  if (exclusive)
+    rwlock_release_write (&inode->rwlock);
+  else
+    rwlock_release_read (&inode->rwlock);
   return bytes_written;
 }
 
@@ -657,8 +962,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -667,9 +974,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -687,4 +996,13 @@ inode_is_dir (const struct inode *inode)
   return inode->data.is_dir;
 }
 
+/* Returns the lock that serializes changes to the entries of
+   directory INODE.  Each directory has its own, so that work in
+   one directory does not wait for another. */
+struct lock *
+inode_dir_lock (struct inode *inode)
+{
+  return &inode->dir_lock;
+}
+
 
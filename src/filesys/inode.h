@@ -4,39 +4,81 @@
 #include <stdbool.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
+#include <hash.h>
 #include <list.h>
+#include "threads/synch.h"
 
 #define NUM_DBLOCKS 124
+#define NUM_EXTENTS (NUM_DBLOCKS / 2)
 struct bitmap;
+
+/* Ways of recording where an inode's data lives on disk. */
+enum inode_layout
+  {
+    INODE_INDEXED,                    /* Direct and double indirect blocks. */
+    INODE_EXTENTS                     /* Runs of contiguous sectors. */
+  };
+
+/* A run of LENGTH contiguous sectors starting at START. */
+struct inode_extent
+  {
+    block_sector_t start;             /* First sector. */
+    block_sector_t length;            /* Number of sectors, 0 if unused. */
+  };
+
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
 {
   //block_sector_t start;               /* First data sector. */
   /* Added */
-  block_sector_t data_blocks[NUM_DBLOCKS];
+  union
+    {
+      block_sector_t data_blocks[NUM_DBLOCKS];  /* INODE_INDEXED. */
+      struct inode_extent extents[NUM_EXTENTS]; /* INODE_EXTENTS. */
+    };
   block_sector_t double_block;
   bool is_dir;
+  uint8_t layout;                     /* An enum inode_layout. */
+  uint8_t dir_format;                 /* If IS_DIR, an enum dir_format. */
   off_t length;                       /* File size in bytes. */
   unsigned magic;                     /* Magic number. */
   //uint32_t unused[125];               /* Not used. */
 };
 
 
-/* In-memory inode. */
+/* In-memory inode.
+
+   RWLOCK is held shared while reading or writing existing data
+   and exclusively while growing the inode or changing REMOVED,
+   DENY_WRITE_CNT or DATA, so that independent readers and
+   writers of one file proceed in parallel.  INDEX_LOCK protects
+   the cached index blocks, which readers fill in on demand.
+   DIR_LOCK, used only by directories, serializes changes to
+   their entries; see inode_dir_lock(). */
 struct inode 
 {
-  struct list_elem elem;              /* Element in inode list. */
+  struct hash_elem elem;              /* Element in open_inodes. */
   block_sector_t sector;              /* Sector number of disk location. */
   int open_cnt;                       /* Number of openers. */
+  bool loading;                       /* Still being read by inode_open()? */
   bool removed;                       /* True if deleted, false otherwise. */
   int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
   struct inode_disk data;             /* Inode content. */
+  block_sector_t *fst_level;          /* Cached level-1 index block. */
+  block_sector_t **snd_levels;        /* Cached level-2 index blocks. */
+  struct rwlock rwlock;               /* Guards data and metadata. */
+  struct lock index_lock;             /* Guards FST_LEVEL, SND_LEVELS. */
+  struct lock dir_lock;               /* Guards directory entries. */
 };
 
 
 
 void inode_init (void);
+void inode_set_default_layout (enum inode_layout);
+enum inode_layout inode_get_layout (const struct inode *);
+int inode_get_dir_format (const struct inode *);
+void inode_set_dir_format (struct inode *, int);
 bool inode_create (bool, block_sector_t, off_t);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
@@ -45,9 +87,12 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+void inode_readahead (struct inode *, off_t offset, off_t size);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+bool inode_is_dir (const struct inode *);
+struct lock *inode_dir_lock (struct inode *);
 
 bool inode_grow(struct inode*, off_t);
 #endif /* filesys/inode.h */
@@ -3,6 +3,7 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -23,11 +24,28 @@ typedef unsigned long elem_type;
 
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   Two summary arrays, with one bit per element of BITS, let
+   searches skip whole runs of elements at a time: bit I of FULL
+   is set if every bit in element I is true, and bit I of USED if
+   any bit in element I is true.  Together with find-first-set on
+   the elements themselves, this makes a search over long runs of
+   the wrong value cost about one step per ELEM_BITS * ELEM_BITS
+   bits.  The summaries are kept in the same allocation as BITS.
+   Functions that change bits update the summaries with
+   interrupts off, so that an element and its summary bits
+   always change together, but as before, a search that races
+   with updates may miss bits that are being changed.
+
+   HINT is where bitmap_scan_and_flip_next() starts looking. */
 struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
     elem_type *bits;    /* Elements that represent bits. */
+    elem_type *full;    /* Bit set if element of BITS is all true. */
+    elem_type *used;    /* Bit set if element of BITS has a true bit. */
+    size_t hint;        /* Next-fit starting point. */
   };
 
 /* Returns the index of the element that contains the bit
@@ -60,6 +78,14 @@ byte_cnt (size_t bit_cnt)
   return sizeof (elem_type) * elem_cnt (bit_cnt);
 }
 
+/* Returns the number of bytes required for BIT_CNT bits and
+   their summaries. */
+static inline size_t
+storage_size (size_t bit_cnt)
+{
+  return byte_cnt (bit_cnt) + 2 * byte_cnt (elem_cnt (bit_cnt));
+}
+
 /* Returns a bit mask in which the bits actually used in the last
    element of B's bits are set to 1 and the rest are set to 0. */
 static inline elem_type
@@ -68,6 +94,129 @@ last_mask (const struct bitmap *b)
   int last_bits = b->bit_cnt % ELEM_BITS;
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns a bit mask in which the bits actually used in element
+   IDX of B's bits are set to 1 and the rest are set to 0. */
+static inline elem_type
+used_mask (const struct bitmap *b, size_t idx)
+{
+  return idx + 1 == elem_cnt (b->bit_cnt) ? last_mask (b) : (elem_type) -1;
+}
+
+/* Returns an elem_type where the bits corresponding to bits
+   START through START + CNT - 1 of the element that contains
+   bit START are turned on.  START % ELEM_BITS + CNT must not
+   exceed ELEM_BITS. */
+static inline elem_type
+range_mask (size_t start, size_t cnt)
+{
+  elem_type mask = (cnt < ELEM_BITS
+                    ? ((elem_type) 1 << cnt) - 1
+                    : (elem_type) -1);
+  return mask << (start % ELEM_BITS);
+}
+
+/* Returns the number of the lowest bit set in X, which must be
+   nonzero. */
+static inline int
+lowest_bit (elem_type x)
+{
+  ASSERT (x != 0);
+  return __builtin_ctzl (x);
+}
+
+/* Returns the number of bits set in X. */
+static inline size_t
+count_bits (elem_type x)
+{
+  size_t cnt = 0;
+  for (; x != 0; x &= x - 1)
+    cnt++;
+  return cnt;
+}
+
+/* Points B's summary arrays into the storage after B's bits. */
+static void
+init_summaries (struct bitmap *b)
+{
+  b->full = b->bits + elem_cnt (b->bit_cnt);
+  b->used = b->full + elem_cnt (elem_cnt (b->bit_cnt));
+  b->hint = 0;
+}
+
+/* Updates B's summaries for element IDX of its bits.  Unless B
+   cannot be changed concurrently, interrupts must be off from
+   before element IDX is changed until after this returns. */
+static void
+update_summary (struct bitmap *b, size_t idx)
+{
+  elem_type bits = b->bits[idx];
+  elem_type mask = used_mask (b, idx);
+  size_t sum_idx = elem_idx (idx);
+  elem_type sum_mask = bit_mask (idx);
+
+  if ((bits & mask) == mask)
+    b->full[sum_idx] |= sum_mask;
+  else
+    b->full[sum_idx] &= ~sum_mask;
+  if (bits != 0)
+    b->used[sum_idx] |= sum_mask;
+  else
+    b->used[sum_idx] &= ~sum_mask;
+}
+
+/* Returns the index of the first bit at or after START among the
+   first BIT_CNT bits of WORDS that is set to VALUE, or BIT_CNT
+   if there is none.  Bits of WORDS past BIT_CNT must be 0. */
+static size_t
+next_bit (const elem_type *words, size_t bit_cnt, size_t start, bool value)
+{
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t idx = elem_idx (start);
+  elem_type w;
+
+  if (start >= bit_cnt)
+    return bit_cnt;
+  w = (words[idx] ^ flip) & ~(bit_mask (start) - 1);
+  while (w == 0)
+    {
+      if (++idx >= elem_cnt (bit_cnt))
+        return bit_cnt;
+      w = words[idx] ^ flip;
+    }
+  start = idx * ELEM_BITS + lowest_bit (w);
+  return start < bit_cnt ? start : bit_cnt;
+}
+
+/* Returns the index of the first bit in B at or after START that
+   is set to VALUE, or B's size if there is none.  Uses the
+   summaries to skip elements that have no bit set to VALUE. */
+static size_t
+find_next (const struct bitmap *b, size_t start, bool value)
+{
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t word_cnt = elem_cnt (b->bit_cnt);
+  size_t idx;
+  elem_type w;
+
+  if (start >= b->bit_cnt)
+    return b->bit_cnt;
+
+  idx = elem_idx (start);
+  w = (b->bits[idx] ^ flip) & used_mask (b, idx) & ~(bit_mask (start) - 1);
+  while (w == 0)
+    {
+      /* Looking for a false bit, skip full elements; for a true
+         bit, skip elements with no true bit. */
+      idx = (value
+             ? next_bit (b->used, word_cnt, idx + 1, true)
+             : next_bit (b->full, word_cnt, idx + 1, false));
+      if (idx >= word_cnt)
+        return b->bit_cnt;
+      w = (b->bits[idx] ^ flip) & used_mask (b, idx);
+    }
+  return idx * ELEM_BITS + lowest_bit (w);
+}
 
 /* Creation and destruction. */
 
@@ -82,9 +231,10 @@ bitmap_create (size_t bit_cnt)
   if (b != NULL)
     {
       b->bit_cnt = bit_cnt;
-      b->bits = malloc (byte_cnt (bit_cnt));
+      b->bits = malloc (storage_size (bit_cnt));
       if (b->bits != NULL || bit_cnt == 0)
         {
+          init_summaries (b);
           bitmap_set_all (b, false);
           return b;
         }
@@ -105,6 +255,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 
   b->bit_cnt = bit_cnt;
   b->bits = (elem_type *) (b + 1);
+  init_summaries (b);
   bitmap_set_all (b, false);
   return b;
 }
@@ -114,7 +265,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 size_t
 bitmap_buf_size (size_t bit_cnt) 
 {
-  return sizeof (struct bitmap) + byte_cnt (bit_cnt);
+  return sizeof (struct bitmap) + storage_size (bit_cnt);
 }
 
 /* Destroys bitmap B, freeing its storage.
@@ -159,11 +310,14 @@ bitmap_mark (struct bitmap *b, size_t bit_idx)
 {
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
-
-  /* This is equivalent to `b->bits[idx] |= mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the OR instruction in [IA32-v2b]. */
-  asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  enum intr_level old_level;
+
+  /* Turn interrupts off so that the bit and B's summaries
+     change together. */
+  old_level = intr_disable ();
+  b->bits[idx] |= mask;
+  update_summary (b, idx);
+  intr_set_level (old_level);
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -172,11 +326,14 @@ bitmap_reset (struct bitmap *b, size_t bit_idx)
 {
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
-
-  /* This is equivalent to `b->bits[idx] &= ~mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the AND instruction in [IA32-v2a]. */
-  asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  enum intr_level old_level;
+
+  /* Turn interrupts off so that the bit and B's summaries
+     change together. */
+  old_level = intr_disable ();
+  b->bits[idx] &= ~mask;
+  update_summary (b, idx);
+  intr_set_level (old_level);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -187,11 +344,14 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
 {
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
-
-  /* This is equivalent to `b->bits[idx] ^= mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the XOR instruction in [IA32-v2b]. */
-  asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  enum intr_level old_level;
+
+  /* Turn interrupts off so that the bit and B's summaries
+     change together. */
+  old_level = intr_disable ();
+  b->bits[idx] ^= mask;
+  update_summary (b, idx);
+  intr_set_level (old_level);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -218,14 +378,33 @@ bitmap_set_all (struct bitmap *b, bool value)
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
+  enum intr_level old_level;
+
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  /* Set the bits one element at a time. */
+  while (cnt > 0)
+    {
+      size_t idx = elem_idx (start);
+      size_t n = ELEM_BITS - start % ELEM_BITS;
+      elem_type mask;
+
+      if (n > cnt)
+        n = cnt;
+      mask = range_mask (start, n);
+      old_level = intr_disable ();
+      if (value)
+        b->bits[idx] |= mask;
+      else
+        b->bits[idx] &= ~mask;
+      update_summary (b, idx);
+      intr_set_level (old_level);
+
+      start += n;
+      cnt -= n;
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -239,11 +418,18 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
+  /* Count the true bits one element at a time. */
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
-  return value_cnt;
+  for (i = 0; i < cnt; )
+    {
+      size_t n = ELEM_BITS - (start + i) % ELEM_BITS;
+      if (n > cnt - i)
+        n = cnt - i;
+      value_cnt += count_bits (b->bits[elem_idx (start + i)]
+                               & range_mask (start + i, n));
+      i += n;
+    }
+  return value ? value_cnt : cnt - value_cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -251,16 +437,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return cnt > 0 && find_next (b, start, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -292,22 +473,33 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Jumps from each run of bits set to VALUE to the end of the
+   run, so that it looks at each run only once. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
+  if (cnt > b->bit_cnt)
+    return BITMAP_ERROR;
+  if (cnt == 0)
+    return start;
+
+  for (;;)
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t end;
+
+      start = find_next (b, start, value);
+      if (start > b->bit_cnt - cnt)
+        return BITMAP_ERROR;
+      end = find_next (b, start, !value);
+      if (end - start >= cnt)
+        return start;
+      start = end;
     }
-  return BITMAP_ERROR;
 }
 
 /* Finds the first group of CNT consecutive bits in B at or after
@@ -325,10 +517,45 @@ bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
     bitmap_set_multiple (b, idx, cnt, !value);
   return idx;
 }
+
+/* Like bitmap_scan_and_flip(), but starts looking just past the
+   group found by the previous call, wrapping around to the
+   beginning of B if necessary ("next fit").  This keeps repeated
+   allocations from rescanning the same full region of B over
+   and over. */
+size_t
+bitmap_scan_and_flip_next (struct bitmap *b, size_t cnt, bool value)
+{
+  size_t idx;
+
+  ASSERT (b != NULL);
+
+  if (b->hint > b->bit_cnt)
+    b->hint = 0;
+  idx = bitmap_scan (b, b->hint, cnt, value);
+  if (idx == BITMAP_ERROR && b->hint > 0)
+    idx = bitmap_scan (b, 0, cnt, value);
+  if (idx != BITMAP_ERROR)
+    {
+      bitmap_set_multiple (b, idx, cnt, !value);
+      b->hint = idx + cnt;
+    }
+  return idx;
+}
 
 /* File input and output. */
 
 #ifdef FILESYS
+/* Recomputes all of B's summaries. */
+static void
+rebuild_summaries (struct bitmap *b)
+{
+  size_t i;
+
+  for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+    update_summary (b, i);
+}
+
 /* Returns the number of bytes needed to store B in a file. */
 size_t
 bitmap_file_size (const struct bitmap *b) 
@@ -347,6 +574,7 @@ bitmap_read (struct bitmap *b, struct file *file)
       off_t size = byte_cnt (b->bit_cnt);
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      rebuild_summaries (b);
     }
   return success;
 }
@@ -359,6 +587,24 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes SIZE bytes of B's file image, starting at byte offset
+   OFS, to the same offset in FILE.  Bytes past the end of the
+   image are ignored.  Returns true if successful, false
+   otherwise. */
+bool
+bitmap_write_part (const struct bitmap *b, struct file *file,
+                   size_t ofs, size_t size)
+{
+  size_t file_size = byte_cnt (b->bit_cnt);
+
+  if (ofs >= file_size)
+    return true;
+  if (size > file_size - ofs)
+    size = file_size - ofs;
+  return (file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+          == (off_t) size);
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -0,0 +1,122 @@
+/* Test program for lib/kernel/bitmap.c.
+
+   Applies random operations to bitmaps of various sizes and
+   checks the results of the word-at-a-time set, count, contains
+   and scan operations against a plain array of bools.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/test.h"
+
+/* Maximum number of bits in a bitmap that we will test. */
+#define MAX_SIZE 1024
+
+/* Number of random operations per bitmap. */
+#define OP_CNT 256
+
+static bool ref[MAX_SIZE];
+
+static size_t ref_scan (size_t size, size_t start, size_t cnt, bool value);
+static void verify (const struct bitmap *, size_t size);
+
+/* Test the bitmap implementation. */
+void
+test (void)
+{
+  size_t size;
+
+  printf ("testing various size bitmaps:");
+  for (size = 0; size <= MAX_SIZE; size += size < 70 ? 1 : 97)
+    {
+      struct bitmap *b = bitmap_create (size);
+      int op;
+
+      ASSERT (b != NULL);
+      memset (ref, 0, sizeof ref);
+      for (op = 0; op < OP_CNT; op++)
+        {
+          size_t start = random_ulong () % (size + 1);
+          size_t cnt = random_ulong () % (size - start + 1);
+          bool value = random_ulong () % 2;
+          size_t i, value_cnt;
+
+          switch (random_ulong () % 4)
+            {
+            case 0:
+              bitmap_set_multiple (b, start, cnt, value);
+              memset (ref + start, value, cnt);
+              break;
+
+            case 1:
+              value_cnt = 0;
+              for (i = start; i < start + cnt; i++)
+                value_cnt += ref[i] == value;
+              ASSERT (bitmap_count (b, start, cnt, value) == value_cnt);
+              ASSERT (bitmap_contains (b, start, cnt, value)
+                      == (value_cnt > 0));
+              break;
+
+            case 2:
+              cnt = random_ulong () % 40;
+              ASSERT (bitmap_scan (b, start, cnt, value)
+                      == ref_scan (size, start, cnt, value));
+              break;
+
+            case 3:
+              cnt = random_ulong () % 20 + 1;
+              i = bitmap_scan_and_flip_next (b, cnt, false);
+              if (i != BITMAP_ERROR)
+                {
+                  ASSERT (ref_scan (size, i, cnt, false) == i);
+                  memset (ref + i, true, cnt);
+                }
+              else
+                ASSERT (ref_scan (size, 0, cnt, false) == BITMAP_ERROR);
+              break;
+            }
+          verify (b, size);
+        }
+      bitmap_destroy (b);
+      printf (" %zu", size);
+    }
+  printf (" done\n");
+  printf ("bitmap: PASS\n");
+}
+
+/* Returns the start of the first group of CNT bits in ref[],
+   which has SIZE elements, at or after START that are all
+   VALUE, or BITMAP_ERROR if there is none. */
+static size_t
+ref_scan (size_t size, size_t start, size_t cnt, bool value)
+{
+  size_t i, j;
+
+  for (i = start; i + cnt <= size; i++)
+    {
+      for (j = 0; j < cnt; j++)
+        if (ref[i + j] != value)
+          break;
+      if (j == cnt)
+        return i;
+    }
+  return BITMAP_ERROR;
+}
+
+/* Checks that the SIZE bits in B match ref[]. */
+static void
+verify (const struct bitmap *b, size_t size)
+{
+  size_t i;
+
+  ASSERT (bitmap_size (b) == size);
+  for (i = 0; i < size; i++)
+    ASSERT (bitmap_test (b, i) == ref[i]);
+}
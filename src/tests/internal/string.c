@@ -0,0 +1,212 @@
+/* Test program for the block operations in lib/string.c.
+
+   Checks memcpy(), memmove(), memset() and memcmp() against
+   byte-at-a-time reference versions for every small size and
+   alignment, then times both on page-sized blocks and prints
+   the speedup.  The timings are only informative, because they
+   vary too much between emulators and CPUs to pass or fail on.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <random.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/test.h"
+
+/* Size of the blocks timed. */
+#define BLOCK_SIZE 4096
+
+/* Number of times each operation is timed; the fastest run
+   counts. */
+#define RUN_CNT 16
+
+static uint8_t src[BLOCK_SIZE + 64], dst[BLOCK_SIZE + 64];
+static uint8_t ref[BLOCK_SIZE + 64];
+
+static void *ref_memcpy (void *, const void *, size_t);
+static void *ref_memmove (void *, const void *, size_t);
+static void *ref_memset (void *, int, size_t);
+static int ref_memcmp (const void *, const void *, size_t);
+static void check_small (void);
+static void bench (const char *name, int op);
+static uint64_t time_op (int op, bool reference);
+
+/* Operations timed by bench(). */
+enum { OP_MEMCPY, OP_MEMMOVE, OP_MEMSET, OP_MEMCMP };
+
+/* Test the block operations. */
+void
+test (void)
+{
+  check_small ();
+  bench ("memcpy", OP_MEMCPY);
+  bench ("memmove", OP_MEMMOVE);
+  bench ("memset", OP_MEMSET);
+  bench ("memcmp", OP_MEMCMP);
+  printf ("string: PASS\n");
+}
+
+/* Compares each operation with its reference version for sizes
+   0 through 64 at every combination of alignments. */
+static void
+check_small (void)
+{
+  size_t size, s_ofs, d_ofs;
+
+  printf ("checking small blocks:");
+  for (size = 0; size <= 64; size++)
+    {
+      for (s_ofs = 0; s_ofs < 8; s_ofs++)
+        for (d_ofs = 0; d_ofs < 8; d_ofs++)
+          {
+            random_bytes (src, sizeof src);
+            memcpy (ref, src, sizeof ref);
+            memcpy (dst, src, sizeof dst);
+
+            ASSERT (memcpy (dst + d_ofs, src + s_ofs, size) == dst + d_ofs);
+            ref_memcpy (ref + d_ofs, src + s_ofs, size);
+            ASSERT (!ref_memcmp (dst, ref, sizeof dst));
+
+            ASSERT (memmove (dst + d_ofs, dst + s_ofs, size) == dst + d_ofs);
+            ref_memmove (ref + d_ofs, ref + s_ofs, size);
+            ASSERT (!ref_memcmp (dst, ref, sizeof dst));
+
+            ASSERT (memset (dst + d_ofs, s_ofs * 37, size) == dst + d_ofs);
+            ref_memset (ref + d_ofs, s_ofs * 37, size);
+            ASSERT (!ref_memcmp (dst, ref, sizeof dst));
+
+            if (size > 0)
+              dst[d_ofs + size - 1] ^= 1 << s_ofs;
+            ASSERT ((memcmp (dst + d_ofs, ref + d_ofs, size) > 0)
+                    == (ref_memcmp (dst + d_ofs, ref + d_ofs, size) > 0));
+            ASSERT ((memcmp (dst + d_ofs, ref + d_ofs, size) < 0)
+                    == (ref_memcmp (dst + d_ofs, ref + d_ofs, size) < 0));
+          }
+      printf (" %zu", size);
+    }
+  printf (" ok\n");
+}
+
+/* Times operation OP, named NAME, on BLOCK_SIZE bytes against
+   its reference version and prints the speedup. */
+static void
+bench (const char *name, int op)
+{
+  uint64_t fast = time_op (op, false);
+  uint64_t slow = time_op (op, true);
+
+  if (fast == 0)
+    fast = 1;
+  printf ("%s: %llu cycles, reference %llu cycles, %llu.%01llux faster\n",
+          name, fast, slow, slow / fast, slow * 10 / fast % 10);
+}
+
+/* Reads the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Returns the fewest cycles taken by RUN_CNT runs of operation
+   OP on BLOCK_SIZE bytes, using the reference version if
+   REFERENCE is true. */
+static uint64_t
+time_op (int op, bool reference)
+{
+  uint64_t best = UINT64_MAX;
+  int i;
+
+  memset (src, 0x5a, sizeof src);
+  memset (dst, 0x5a, sizeof dst);
+  for (i = 0; i < RUN_CNT; i++)
+    {
+      uint64_t start = rdtsc ();
+      uint64_t cycles;
+
+      switch (op)
+        {
+        case OP_MEMCPY:
+          (reference ? ref_memcpy : memcpy) (dst, src, BLOCK_SIZE);
+          break;
+        case OP_MEMMOVE:
+          (reference ? ref_memmove : memmove) (dst + 4, dst, BLOCK_SIZE);
+          break;
+        case OP_MEMSET:
+          (reference ? ref_memset : memset) (dst, i, BLOCK_SIZE);
+          break;
+        case OP_MEMCMP:
+          ASSERT ((reference ? ref_memcmp : memcmp) (dst, dst + 32,
+                                                      BLOCK_SIZE) == 0);
+          break;
+        }
+
+      cycles = rdtsc () - start;
+      if (cycles < best)
+        best = cycles;
+    }
+  return best;
+}
+
+/* Byte-at-a-time memcpy(). */
+static void *
+ref_memcpy (void *dst_, const void *src_, size_t size)
+{
+  uint8_t *dst = dst_;
+  const uint8_t *src = src_;
+
+  while (size-- > 0)
+    *dst++ = *src++;
+  return dst_;
+}
+
+/* Byte-at-a-time memmove(). */
+static void *
+ref_memmove (void *dst_, const void *src_, size_t size)
+{
+  uint8_t *dst = dst_;
+  const uint8_t *src = src_;
+
+  if (dst < src)
+    while (size-- > 0)
+      *dst++ = *src++;
+  else
+    {
+      dst += size;
+      src += size;
+      while (size-- > 0)
+        *--dst = *--src;
+    }
+  return dst_;
+}
+
+/* Byte-at-a-time memset(). */
+static void *
+ref_memset (void *dst_, int value, size_t size)
+{
+  uint8_t *dst = dst_;
+
+  while (size-- > 0)
+    *dst++ = value;
+  return dst_;
+}
+
+/* Byte-at-a-time memcmp(). */
+static int
+ref_memcmp (const void *a_, const void *b_, size_t size)
+{
+  const uint8_t *a = a_;
+  const uint8_t *b = b_;
+
+  for (; size-- > 0; a++, b++)
+    if (*a != *b)
+      return *a > *b ? +1 : -1;
+  return 0;
+}
@@ -1,4 +1,5 @@
 #include "threads/fixed_point_number.h"
+#include <stdint.h>
 
 /* x and y represent float numbers while n represents an integer.
 */
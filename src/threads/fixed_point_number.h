@@ -3,4 +3,17 @@
 
 #define FIXED_CONSTANT 14
 
+/* 17.14 fixed-point arithmetic.  X and Y are fixed-point
+   numbers, N is an integer. */
+int convert_to_fixed_point (int n);
+int convert_to_int (int x);
+int multiply_float (int x, int y);
+int multiply_int (int x, int n);
+int add_int (int x, int n);
+int add_float (int x, int y);
+int sub_int (int x, int n);
+int sub_float (int x, int y);
+int divide_float (int x, int y);
+int divide_int (int x, int n);
+
 #endif /* threads/fixed_point_number.h */
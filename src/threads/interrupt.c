@@ -354,6 +354,9 @@ intr_handler (struct intr_frame *frame)
 
       in_external_intr = true;
       yield_on_return = false;
+
+      /* Catch up on ticks skipped while idle. */
+      timer_resume ();
     }
 
   /* Invoke the interrupt's handler. */
@@ -2,13 +2,16 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -23,7 +26,41 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is managed by a binary buddy allocator.  Free pages
+   are kept in blocks of 2**ORDER pages, for ORDER up to
+   MAX_ORDER, each block aligned to its size relative to the
+   pool's base, with one free list per order.  An allocation
+   takes a block of the smallest sufficient order, splitting a
+   larger one if necessary, and gives back the pages beyond the
+   ones requested.  Freeing a block merges it with its "buddy",
+   the other half of the block of the next higher order, for as
+   long as the buddy is free too.  Both take O(log n) time.
+
+   Single pages, by far the most common request, usually do not
+   reach the buddy allocator.  Each pool keeps a cache of free
+   pages, accessed with interrupts briefly disabled rather than
+   under the pool's lock, which is refilled from and drained to
+   the buddy allocator CACHE_BATCH pages at a time.  Cached pages
+   count as allocated in the pool's used_map.  Each pool also
+   keeps a supply of pages that the "zeroer" thread has already
+   filled with zeros, for PAL_ZERO requests.  If the buddy
+   allocator runs out of pages, both are given back to it. */
+
+/* Largest block order. */
+#define MAX_ORDER 10
+
+/* In a pool's order map, marks the first page of a free block.
+   The low bits give the block's order. */
+#define ORDER_FREE 0x80
+
+/* Page cache sizes. */
+#define CACHE_MAX 32            /* Most pages in a pool's cache. */
+#define CACHE_BATCH 8           /* Pages moved to or from the buddy
+                                   allocator at once. */
+#define ZEROED_MAX 16           /* Most zeroed pages per pool. */
+#define ZEROED_LOW 8            /* Wake the zeroer below this. */
 
 /* A memory pool. */
 struct pool
@@ -31,6 +68,22 @@ struct pool
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
+    uint8_t *order_map;                 /* Per page: ORDER_FREE | order
+                                           if a free block starts here. */
+    struct list free_lists[MAX_ORDER + 1]; /* Free blocks by order. */
+    size_t free_cnt[MAX_ORDER + 1];     /* Blocks in each free list. */
+
+    /* Accessed with interrupts off. */
+    struct list cache;                  /* Cached free pages. */
+    size_t cache_cnt;                   /* Number of pages in cache. */
+    struct list zeroed;                 /* Zeroed free pages. */
+    size_t zeroed_cnt;                  /* Number of pages in zeroed. */
+  };
+
+/* A free block, stored in its first page. */
+struct free_block
+  {
+    struct list_elem elem;              /* Element in a free list. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -39,6 +92,20 @@ static struct pool kernel_pool, user_pool;
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void print_pool_stats (struct pool *, const char *name);
+static void *pool_get (struct pool *, size_t page_cnt);
+static void pool_put (struct pool *, struct list *pages);
+static bool pool_reclaim (struct pool *);
+static void *cache_get (struct pool *, enum palloc_flags, bool use_zeroed);
+static void cache_put (struct pool *, void *page);
+
+/* The zeroer thread sleeps on this while it has nothing to do. */
+static struct semaphore zeroer_sema;
+static bool zeroer_idle;
+static thread_func zeroer;
+static void wake_zeroer (struct pool *);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -59,6 +126,16 @@ palloc_init (size_t user_page_limit)
   init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
   init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
              user_pages, "user pool");
+  sema_init (&zeroer_sema, 0);
+}
+
+/* Starts the thread that keeps each pool's supply of zeroed
+   pages topped up in the background.  Must be called after
+   thread_start(). */
+void
+palloc_start_zeroer (void)
+{
+  thread_create ("zeroer", PRI_MIN, zeroer, NULL);
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
@@ -72,23 +149,21 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
-  size_t page_idx;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
-
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
-  else
-    pages = NULL;
+  /* A single page comes from the page cache, which zeroes it
+     itself if asked. */
+  do
+    pages = (page_cnt == 1
+             ? cache_get (pool, flags, true)
+             : pool_get (pool, page_cnt));
+  while (pages == NULL && pool_reclaim (pool));
 
   if (pages != NULL) 
     {
-      if (flags & PAL_ZERO)
+      if ((flags & PAL_ZERO) && page_cnt > 1)
         memset (pages, 0, PGSIZE * page_cnt);
     }
   else 
@@ -137,8 +212,18 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  if (page_cnt == 1)
+    {
+      ASSERT (bitmap_test (pool->used_map, page_idx));
+      cache_put (pool, pages);
+      return;
+    }
+
+  lock_acquire (&pool->lock);
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  buddy_free (pool, page_idx, page_cnt);
+  lock_release (&pool->lock);
 }
 
 /* Frees the page at PAGE. */
@@ -153,10 +238,13 @@ palloc_free_page (void *page)
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
+  /* We'll put the pool's used_map and order map at its base.
+     Calculate the space needed for them
      and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t bm_pages = DIV_ROUND_UP (bm_size + page_cnt, PGSIZE);
+  int order;
+
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
@@ -165,8 +253,375 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
 
   /* Initialize the pool. */
   lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->order_map = (uint8_t *) base + bm_size;
+  memset (p->order_map, 0, page_cnt);
   p->base = base + bm_pages * PGSIZE;
+  for (order = 0; order <= MAX_ORDER; order++)
+    {
+      list_init (&p->free_lists[order]);
+      p->free_cnt[order] = 0;
+    }
+  list_init (&p->cache);
+  p->cache_cnt = 0;
+  list_init (&p->zeroed);
+  p->zeroed_cnt = 0;
+
+  /* Hand all the pages to the buddy allocator. */
+  buddy_free (p, 0, page_cnt);
+}
+
+/* Prints the number of free blocks of each order in each
+   pool. */
+void
+palloc_print_stats (void)
+{
+  print_pool_stats (&kernel_pool, "kernel pool");
+  print_pool_stats (&user_pool, "user pool");
+}
+
+/* Prints the number of free blocks of each order in POOL, which
+   is called NAME, and how contended its lock has been.  Does not
+   take POOL's lock, so that it can be called while shutting down
+   after a panic. */
+static void
+print_pool_stats (struct pool *pool, const char *name)
+{
+  size_t free_pages = 0;
+  int order;
+
+  printf ("Page allocator: %s free blocks by order:", name);
+  for (order = 0; order <= MAX_ORDER; order++)
+    {
+      printf (" %zu", pool->free_cnt[order]);
+      free_pages += pool->free_cnt[order] << order;
+    }
+  printf (" (%zu pages), %zu cached, %zu zeroed\n",
+          free_pages, pool->cache_cnt, pool->zeroed_cnt);
+  printf ("Page allocator: %s lock acquired %u times, %u contended\n",
+          name, pool->lock.acquire_cnt, pool->lock.contend_cnt);
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL's buddy
+   allocator.  Returns the first page, or a null pointer if
+   there are not enough free pages. */
+static void *
+pool_get (struct pool *pool, size_t page_cnt)
+{
+  size_t page_idx;
+
+  lock_acquire (&pool->lock);
+  page_idx = buddy_alloc (pool, page_cnt);
+  if (page_idx != BITMAP_ERROR)
+    bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+  lock_release (&pool->lock);
+
+  return page_idx != BITMAP_ERROR ? pool->base + PGSIZE * page_idx : NULL;
+}
+
+/* Returns the single pages in list PAGES, which were taken from
+   POOL's page caches, to POOL's buddy allocator. */
+static void
+pool_put (struct pool *pool, struct list *pages)
+{
+  lock_acquire (&pool->lock);
+  while (!list_empty (pages))
+    {
+      size_t page_idx = pg_no (list_pop_front (pages)) - pg_no (pool->base);
+      bitmap_reset (pool->used_map, page_idx);
+      buddy_free (pool, page_idx, 1);
+    }
+  lock_release (&pool->lock);
+}
+
+/* Returns all the pages in POOL's page caches to its buddy
+   allocator, so that they can be combined into larger blocks.
+   Returns true if there were any. */
+static bool
+pool_reclaim (struct pool *pool)
+{
+  struct list pages;
+  enum intr_level old_level;
+
+  list_init (&pages);
+  old_level = intr_disable ();
+  while (!list_empty (&pool->cache))
+    list_push_back (&pages, list_pop_front (&pool->cache));
+  while (!list_empty (&pool->zeroed))
+    list_push_back (&pages, list_pop_front (&pool->zeroed));
+  pool->cache_cnt = pool->zeroed_cnt = 0;
+  intr_set_level (old_level);
+
+  if (list_empty (&pages))
+    return false;
+  pool_put (pool, &pages);
+  return true;
+}
+
+/* Takes a single page from POOL's page caches, refilling them
+   from the buddy allocator if they are empty.  If FLAGS has
+   PAL_ZERO set, prefers a page that is already zeroed and zeroes
+   any other.  Falls back on a zeroed page when the rest of POOL
+   is exhausted only if USE_ZEROED is true.  Returns a null
+   pointer if no suitable page is left. */
+static void *
+cache_get (struct pool *pool, enum palloc_flags flags, bool use_zeroed)
+{
+  struct list_elem *page = NULL;
+  bool zeroed = false;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if ((flags & PAL_ZERO) && !list_empty (&pool->zeroed))
+    {
+      page = list_pop_front (&pool->zeroed);
+      pool->zeroed_cnt--;
+      zeroed = true;
+      wake_zeroer (pool);
+    }
+  else
+    {
+      if (list_empty (&pool->cache))
+        {
+          /* Refill the cache with a batch of pages. */
+          struct list pages;
+          size_t page_cnt = 0;
+
+          intr_set_level (old_level);
+          list_init (&pages);
+          lock_acquire (&pool->lock);
+          while (page_cnt < CACHE_BATCH)
+            {
+              size_t page_idx = buddy_alloc (pool, 1);
+              if (page_idx == BITMAP_ERROR)
+                break;
+              bitmap_mark (pool->used_map, page_idx);
+              list_push_back (&pages, (struct list_elem *)
+                              (pool->base + PGSIZE * page_idx));
+              page_cnt++;
+            }
+          lock_release (&pool->lock);
+
+          old_level = intr_disable ();
+          while (!list_empty (&pages))
+            list_push_back (&pool->cache, list_pop_front (&pages));
+          pool->cache_cnt += page_cnt;
+        }
+
+      if (!list_empty (&pool->cache))
+        {
+          page = list_pop_front (&pool->cache);
+          pool->cache_cnt--;
+        }
+      else if (use_zeroed && !list_empty (&pool->zeroed))
+        {
+          page = list_pop_front (&pool->zeroed);
+          pool->zeroed_cnt--;
+          zeroed = true;
+        }
+    }
+  intr_set_level (old_level);
+
+  /* The list element in a zeroed page is not zero. */
+  if (page != NULL && (flags & PAL_ZERO))
+    memset (page, 0, zeroed ? sizeof *page : PGSIZE);
+  return page;
+}
+
+/* Puts single page PAGE, from POOL, into POOL's page cache,
+   returning a batch of pages to the buddy allocator if the cache
+   is full. */
+static void
+cache_put (struct pool *pool, void *page)
+{
+  struct list pages;
+  enum intr_level old_level;
+
+  list_init (&pages);
+  old_level = intr_disable ();
+  list_push_front (&pool->cache, page);
+  if (++pool->cache_cnt > CACHE_MAX)
+    {
+      /* Give back the least recently freed pages. */
+      int i;
+      for (i = 0; i < CACHE_BATCH; i++)
+        list_push_back (&pages, list_pop_back (&pool->cache));
+      pool->cache_cnt -= CACHE_BATCH;
+    }
+  wake_zeroer (pool);
+  intr_set_level (old_level);
+
+  if (!list_empty (&pages))
+    pool_put (pool, &pages);
+}
+
+/* Wakes the zeroer thread if it is asleep and POOL is running
+   low on zeroed pages.  Interrupts must be off. */
+static void
+wake_zeroer (struct pool *pool)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (zeroer_idle && pool->zeroed_cnt < ZEROED_LOW)
+    {
+      zeroer_idle = false;
+      sema_up (&zeroer_sema);
+    }
+}
+
+/* Tops up POOL's supply of zeroed pages by one page, taking the
+   page from POOL's page cache or buddy allocator, never from the
+   supply itself.  Returns false if the supply is full or no other
+   page is free. */
+static bool
+zero_one_page (struct pool *pool, enum palloc_flags flags)
+{
+  struct list_elem *page;
+  enum intr_level old_level;
+
+  if (pool->zeroed_cnt >= ZEROED_MAX)
+    return false;
+  page = cache_get (pool, flags & ~PAL_ZERO, false);
+  if (page == NULL)
+    return false;
+  memset (page, 0, PGSIZE);
+
+  old_level = intr_disable ();
+  list_push_back (&pool->zeroed, page);
+  pool->zeroed_cnt++;
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Thread function for the zeroer thread, which zeroes free pages
+   ahead of time, at the lowest priority, so that PAL_ZERO
+   requests need not wait for it. */
+static void
+zeroer (void *aux UNUSED)
+{
+  /* Stay out of the way of other threads under the MLFQS too. */
+  if (thread_mlfqs)
+    thread_set_nice (20);
+
+  for (;;)
+    {
+      bool progress = zero_one_page (&kernel_pool, 0);
+      progress |= zero_one_page (&user_pool, PAL_USER);
+      if (!progress)
+        {
+          enum intr_level old_level = intr_disable ();
+          zeroer_idle = true;
+          sema_down (&zeroer_sema);
+          intr_set_level (old_level);
+        }
+    }
+}
+
+/* Returns the kernel virtual address of page PAGE_IDX in POOL,
+   viewed as a free block. */
+static struct free_block *
+block_at (struct pool *pool, size_t page_idx)
+{
+  return (struct free_block *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Adds the block of 2**ORDER pages starting at page PAGE_IDX in
+   POOL to the free list for ORDER. */
+static void
+push_block (struct pool *pool, size_t page_idx, int order)
+{
+  pool->order_map[page_idx] = ORDER_FREE | order;
+  list_push_front (&pool->free_lists[order],
+                   &block_at (pool, page_idx)->elem);
+  pool->free_cnt[order]++;
+}
+
+/* Removes the free block of 2**ORDER pages starting at page
+   PAGE_IDX in POOL from its free list. */
+static void
+remove_block (struct pool *pool, size_t page_idx, int order)
+{
+  ASSERT (pool->order_map[page_idx] == (ORDER_FREE | order));
+
+  pool->order_map[page_idx] = 0;
+  list_remove (&block_at (pool, page_idx)->elem);
+  pool->free_cnt[order]--;
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first, or BITMAP_ERROR if no free block is large
+   enough.  POOL's lock must be held. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt)
+{
+  int order, want;
+  size_t page_idx;
+
+  /* Find the smallest order that holds PAGE_CNT pages. */
+  for (want = 0; want <= MAX_ORDER; want++)
+    if (((size_t) 1 << want) >= page_cnt)
+      break;
+  if (want > MAX_ORDER)
+    return BITMAP_ERROR;
+
+  /* Take the smallest free block at least that big. */
+  for (order = want; order <= MAX_ORDER; order++)
+    if (!list_empty (&pool->free_lists[order]))
+      break;
+  if (order > MAX_ORDER)
+    return BITMAP_ERROR;
+  page_idx = (pg_no (list_front (&pool->free_lists[order]))
+              - pg_no (pool->base));
+  remove_block (pool, page_idx, order);
+
+  /* Split it down to the order wanted, freeing the upper
+     halves. */
+  while (order > want)
+    {
+      order--;
+      push_block (pool, page_idx + ((size_t) 1 << order), order);
+    }
+
+  /* Give back the pages beyond PAGE_CNT. */
+  buddy_free (pool, page_idx + page_cnt, ((size_t) 1 << want) - page_cnt);
+  return page_idx;
+}
+
+/* Frees the PAGE_CNT pages starting at page PAGE_IDX in POOL,
+   merging them with free buddies.  POOL's lock must be held,
+   except during initialization. */
+static void
+buddy_free (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  size_t pool_pages = bitmap_size (pool->used_map);
+
+  /* Free the range as the largest aligned blocks that fit. */
+  while (page_cnt > 0)
+    {
+      size_t idx = page_idx;
+      int order = 0;
+
+      while (order < MAX_ORDER
+             && idx % ((size_t) 1 << (order + 1)) == 0
+             && ((size_t) 1 << (order + 1)) <= page_cnt)
+        order++;
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+
+      /* Merge with the buddy for as long as it is free. */
+      while (order < MAX_ORDER)
+        {
+          size_t buddy = idx ^ ((size_t) 1 << order);
+          if (buddy + ((size_t) 1 << order) > pool_pages
+              || pool->order_map[buddy] != (ORDER_FREE | order))
+            break;
+          remove_block (pool, buddy, order);
+          if (buddy < idx)
+            idx = buddy;
+          order++;
+        }
+      push_block (pool, idx, order);
+    }
 }
 
 /* Returns true if PAGE was allocated from POOL,
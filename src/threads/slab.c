@@ -0,0 +1,359 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A slab allocator for fixed-size kernel objects.
+
+   malloc() rounds every request up to a power of 2, so an object
+   a little over a power of 2 wastes almost half of its block, and
+   all objects of similar size contend for one descriptor lock.
+   A `struct kmem_cache' instead serves a single object type.  It
+   carves single pages, called slabs, into objects of the exact
+   size needed, rounded up only to OBJ_ALIGN.  Each slab starts
+   with a `struct slab' header, so the slab that an object belongs
+   to is found by rounding its address down to a page boundary.
+
+   A cache may have a constructor, which is run on each object
+   when its slab is created.  Objects must be freed in their
+   constructed state, so that expensive initialization, such as
+   setting up the locks inside an object, is done once per slab
+   rather than once per allocation.  To preserve the constructed
+   state, the link that chains a free object into its slab's free
+   list is placed after the object, not inside it, for caches with
+   a constructor.
+
+   In front of the slabs sits a magazine, a small stack of
+   recently freed objects that is accessed with interrupts turned
+   off.  Most allocations are served from it without taking the
+   cache's lock.  When it is empty, it is refilled with a batch of
+   MAG_BATCH objects taken from the slabs under the lock; when it
+   is full, the oldest MAG_BATCH objects are returned to their
+   slabs.
+
+   A slab whose objects are all free is kept on the cache's empty
+   list, but only one such slab is kept per cache; any more are
+   given back to the page allocator. */
+
+/* Number of objects moved between the magazine and the slabs at
+   a time. */
+#define MAG_BATCH (MAG_SIZE / 2)
+
+/* Alignment of objects within a slab. */
+#define OBJ_ALIGN 8
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Slab header, at the start of each slab's page. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in one of the cache's lists. */
+    size_t in_use;              /* Number of allocated objects. */
+    void *free;                 /* First free object. */
+  };
+
+/* Offset of the first object in a slab. */
+#define SLAB_HDR_SIZE ROUND_UP (sizeof (struct slab), OBJ_ALIGN)
+
+/* All caches, for kmem_print_stats(). */
+static struct list all_caches = LIST_INITIALIZER (all_caches);
+
+static void *slab_get (struct kmem_cache *);
+static void slab_put (struct kmem_cache *, void *obj);
+static struct slab *slab_create (struct kmem_cache *);
+static struct slab *obj_to_slab (void *obj);
+
+/* Returns the free-list link of free object OBJ in cache C. */
+static inline void **
+obj_link (struct kmem_cache *c, void *obj)
+{
+  return (void **) ((uint8_t *) obj + c->link_ofs);
+}
+
+/* Initializes cache C for objects of SIZE bytes, naming it NAME
+   for statistics.  If CTOR is nonnull, it is called on each
+   object as its slab is created. */
+void
+kmem_cache_init (struct kmem_cache *c, const char *name, size_t size,
+                 kmem_ctor_func *ctor)
+{
+  enum intr_level old_level;
+
+  ASSERT (c != NULL);
+  ASSERT (size > 0);
+
+  c->name = name;
+  c->obj_size = size;
+  c->ctor = ctor;
+  if (ctor != NULL)
+    {
+      c->link_ofs = ROUND_UP (size, sizeof (void *));
+      c->stride = c->link_ofs + sizeof (void *);
+    }
+  else
+    {
+      c->link_ofs = 0;
+      c->stride = size > sizeof (void *) ? size : sizeof (void *);
+    }
+  c->stride = ROUND_UP (c->stride, OBJ_ALIGN);
+  c->slab_objs = (PGSIZE - SLAB_HDR_SIZE) / c->stride;
+  ASSERT (c->slab_objs > 0);
+
+  lock_init (&c->lock);
+  list_init (&c->full);
+  list_init (&c->partial);
+  list_init (&c->empty);
+  c->slab_cnt = 0;
+  c->mag_cnt = 0;
+  c->alloc_cnt = c->free_cnt = c->mag_hit_cnt = 0;
+
+  old_level = intr_disable ();
+  list_push_back (&all_caches, &c->elem);
+  intr_set_level (old_level);
+}
+
+/* Allocates an object from cache C and returns it, in its
+   constructed state if C has a constructor.  Returns a null
+   pointer if no memory is available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  void *batch[MAG_BATCH];
+  size_t cnt;
+  void *obj = NULL;
+  enum intr_level old_level;
+
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  if (c->mag_cnt > 0)
+    {
+      obj = c->mag[--c->mag_cnt];
+      c->mag_hit_cnt++;
+      c->alloc_cnt++;
+    }
+  intr_set_level (old_level);
+  if (obj != NULL)
+    return obj;
+
+  /* Take a batch of objects from the slabs, one for the caller
+     and the rest for the magazine. */
+  lock_acquire (&c->lock);
+  for (cnt = 0; cnt < MAG_BATCH; cnt++)
+    {
+      batch[cnt] = slab_get (c);
+      if (batch[cnt] == NULL)
+        break;
+    }
+  lock_release (&c->lock);
+  if (cnt == 0)
+    return NULL;
+  obj = batch[--cnt];
+
+  old_level = intr_disable ();
+  c->alloc_cnt++;
+  while (cnt > 0 && c->mag_cnt < MAG_SIZE)
+    c->mag[c->mag_cnt++] = batch[--cnt];
+  intr_set_level (old_level);
+
+  /* Objects freed meanwhile may have filled the magazine. */
+  if (cnt > 0)
+    {
+      lock_acquire (&c->lock);
+      while (cnt > 0)
+        slab_put (c, batch[--cnt]);
+      lock_release (&c->lock);
+    }
+  return obj;
+}
+
+/* Allocates an object from cache C, which must not have a
+   constructor, and fills it with zeros.  Returns a null pointer
+   if no memory is available. */
+void *
+kmem_cache_zalloc (struct kmem_cache *c)
+{
+  void *obj;
+
+  ASSERT (c->ctor == NULL);
+
+  obj = kmem_cache_alloc (c);
+  if (obj != NULL)
+    memset (obj, 0, c->obj_size);
+  return obj;
+}
+
+/* Frees OBJ, which must have been allocated from cache C.  Does
+   nothing if OBJ is a null pointer. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj)
+{
+  void *batch[MAG_BATCH];
+  enum intr_level old_level;
+  size_t i;
+
+  if (obj == NULL)
+    return;
+  ASSERT (!intr_context ());
+  ASSERT (obj_to_slab (obj)->cache == c);
+
+#ifndef NDEBUG
+  /* Clear the object to help detect use-after-free bugs. */
+  if (c->ctor == NULL)
+    memset (obj, 0xcc, c->obj_size);
+#endif
+
+  old_level = intr_disable ();
+  c->free_cnt++;
+  if (c->mag_cnt < MAG_SIZE)
+    {
+      c->mag[c->mag_cnt++] = obj;
+      intr_set_level (old_level);
+      return;
+    }
+
+  /* The magazine is full.  Return its oldest objects, at the
+     bottom, to the slabs, keeping the recently used ones. */
+  memcpy (batch, c->mag, sizeof batch);
+  memmove (c->mag, c->mag + MAG_BATCH,
+           (MAG_SIZE - MAG_BATCH) * sizeof *c->mag);
+  c->mag_cnt -= MAG_BATCH;
+  c->mag[c->mag_cnt++] = obj;
+  intr_set_level (old_level);
+
+  lock_acquire (&c->lock);
+  for (i = 0; i < MAG_BATCH; i++)
+    slab_put (c, batch[i]);
+  lock_release (&c->lock);
+}
+
+/* Prints statistics for each cache.  Does not take the caches'
+   locks, so that it can be called while shutting down after a
+   panic. */
+void
+kmem_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&all_caches); e != list_end (&all_caches);
+       e = list_next (e))
+    {
+      struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+      printf ("Slab: %s: %zu-byte objects, %zu per slab, %zu slabs, "
+              "%llu in use, %llu allocs (%llu from magazine)\n",
+              c->name, c->obj_size, c->slab_objs, c->slab_cnt,
+              c->alloc_cnt - c->free_cnt, c->alloc_cnt, c->mag_hit_cnt);
+    }
+}
+
+/* Takes a free object from one of cache C's slabs, creating a
+   slab if there is none with a free object.  Returns a null
+   pointer if no memory is available.  C's lock must be held. */
+static void *
+slab_get (struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  if (!list_empty (&c->partial))
+    s = list_entry (list_front (&c->partial), struct slab, elem);
+  else if (!list_empty (&c->empty))
+    s = list_entry (list_front (&c->empty), struct slab, elem);
+  else
+    {
+      s = slab_create (c);
+      if (s == NULL)
+        return NULL;
+    }
+
+  obj = s->free;
+  s->free = *obj_link (c, obj);
+  list_remove (&s->elem);
+  if (++s->in_use == c->slab_objs)
+    list_push_front (&c->full, &s->elem);
+  else
+    list_push_front (&c->partial, &s->elem);
+  return obj;
+}
+
+/* Returns free object OBJ to its slab in cache C.  If that
+   leaves the slab unused and C already has an unused slab, gives
+   the slab's page back to the page allocator.  C's lock must be
+   held. */
+static void
+slab_put (struct kmem_cache *c, void *obj)
+{
+  struct slab *s = obj_to_slab (obj);
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+  ASSERT (s->in_use > 0);
+
+  *obj_link (c, obj) = s->free;
+  s->free = obj;
+  list_remove (&s->elem);
+  if (--s->in_use > 0)
+    list_push_front (&c->partial, &s->elem);
+  else if (list_empty (&c->empty))
+    list_push_front (&c->empty, &s->elem);
+  else
+    {
+      s->magic = 0;
+      c->slab_cnt--;
+      palloc_free_page (s);
+    }
+}
+
+/* Creates a slab for cache C, constructs its objects, and adds it
+   to C's empty list.  Returns the slab, or a null pointer if no
+   page is available.  C's lock must be held. */
+static struct slab *
+slab_create (struct kmem_cache *c)
+{
+  struct slab *s = palloc_get_page (0);
+  size_t i;
+
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->in_use = 0;
+  s->free = NULL;
+  for (i = c->slab_objs; i-- > 0; )
+    {
+      void *obj = (uint8_t *) s + SLAB_HDR_SIZE + i * c->stride;
+      if (c->ctor != NULL)
+        c->ctor (obj);
+      *obj_link (c, obj) = s->free;
+      s->free = obj;
+    }
+  list_push_front (&c->empty, &s->elem);
+  c->slab_cnt++;
+  return s;
+}
+
+/* Returns the slab that OBJ is inside. */
+static struct slab *
+obj_to_slab (void *obj)
+{
+  struct slab *s = pg_round_down (obj);
+
+  /* Check that the slab is valid. */
+  ASSERT (s->magic == SLAB_MAGIC);
+
+  /* Check that the object is properly aligned for the slab. */
+  ASSERT (pg_ofs (obj) >= SLAB_HDR_SIZE);
+  ASSERT ((pg_ofs (obj) - SLAB_HDR_SIZE) % s->cache->stride == 0);
+
+  return s;
+}
@@ -0,0 +1,54 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stddef.h>
+#include "threads/synch.h"
+
+/* Number of freed objects a cache's magazine holds. */
+#define MAG_SIZE 16
+
+/* Prepares a newly carved object OBJ.  Objects are constructed
+   once, when their slab is created, and must be returned to the
+   cache in their constructed state. */
+typedef void kmem_ctor_func (void *obj);
+
+/* A cache of objects of one size.
+
+   Objects are carved from single-page slabs at their exact size,
+   rounded up only for alignment.  Recently freed objects are kept
+   in a small magazine that is accessed with interrupts off, so
+   that most allocations and frees do not touch LOCK or the slab
+   lists at all. */
+struct kmem_cache
+  {
+    const char *name;           /* Name, for statistics. */
+    size_t obj_size;            /* Size requested by the user. */
+    size_t stride;              /* Distance between objects in a slab. */
+    size_t link_ofs;            /* Offset of a free object's link. */
+    size_t slab_objs;           /* Objects per slab. */
+    kmem_ctor_func *ctor;       /* Constructor, or a null pointer. */
+    struct list_elem elem;      /* Element in the list of all caches. */
+
+    struct lock lock;           /* Guards the slab lists. */
+    struct list full;           /* Slabs with no free objects. */
+    struct list partial;        /* Slabs with some objects in use. */
+    struct list empty;          /* Slabs with no objects in use. */
+    size_t slab_cnt;            /* Number of slabs. */
+
+    void *mag[MAG_SIZE];        /* Magazine of free objects. */
+    size_t mag_cnt;             /* Number of objects in MAG. */
+
+    unsigned long long alloc_cnt;   /* Number of allocations. */
+    unsigned long long free_cnt;    /* Number of frees. */
+    unsigned long long mag_hit_cnt; /* Allocations served by MAG. */
+  };
+
+void kmem_cache_init (struct kmem_cache *, const char *name, size_t size,
+                      kmem_ctor_func *);
+void *kmem_cache_alloc (struct kmem_cache *);
+void *kmem_cache_zalloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+void kmem_print_stats (void);
+
+#endif /* threads/slab.h */
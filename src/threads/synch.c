@@ -101,7 +101,8 @@ sema_try_down (struct semaphore *sema)
 }
 
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up one thread of those waiting for SEMA, if any,
+   yielding the CPU to it if it has a higher priority.
 
    This function may be called from an interrupt handler. */
 void
@@ -123,12 +124,8 @@ sema_up (struct semaphore *sema)
   }
   sema->value++;
   intr_set_level (old_level);
-  if (any_unblock){
-    if (intr_context())
-      intr_yield_on_return();
-    else
-      thread_yield();
-  }
+  if (any_unblock)
+    thread_yield_to_higher ();
 }
 
 static void sema_test_helper (void *sema_);
@@ -168,6 +165,12 @@ sema_test_helper (void *sema_)
     }
 }
 
+/* Maximum number of lock holders down a chain that a waiting
+   thread donates its priority to. */
+#define DONATION_DEPTH 8
+
+static void donate_priority (struct thread *);
+
 /* Initializes LOCK.  A lock can be held by at most a single
    thread at any given time.  Our locks are not "recursive", that
    is, it is an error for the thread currently holding a lock to
@@ -190,12 +193,19 @@ lock_init (struct lock *lock)
 
   lock->holder = NULL;
   sema_init (&lock->semaphore, 1);
+  lock->acquire_cnt = 0;
+  lock->contend_cnt = 0;
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
 
+   If LOCK is free, it is taken at once, without going through
+   sema_down().  Otherwise the caller donates its priority to the
+   holder and sleeps.  There is no point in spinning first: with
+   a single CPU, the holder cannot run while we spin.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
@@ -211,12 +221,51 @@ lock_acquire (struct lock *lock)
 
   old_level = intr_disable ();
   cur=thread_current ();
-  sema_down (&lock->semaphore);
+  lock->acquire_cnt++;
+  if (lock->semaphore.value > 0)
+    {
+      /* Uncontended fast path. */
+      lock->semaphore.value--;
+    }
+  else
+    {
+      lock->contend_cnt++;
+      if (lock->holder != NULL && !is_thread_mlfqs ())
+        {
+          cur->waiting_lock = lock;
+          donate_priority (cur);
+        }
+      sema_down (&lock->semaphore);
+      cur->waiting_lock = NULL;
+    }
   lock->holder = cur;
- // list_push_back(&current_t->lock_list, &lock->elem); 
+  list_push_back (&cur->held_locks, &lock->elem);
   intr_set_level (old_level);
 }
 
+/* Donates thread T's priority to the holder of the lock T waits
+   for, and on down the chain of holders that are themselves
+   waiting for locks, so that none of them keeps T waiting behind
+   lower-priority threads.  Follows at most DONATION_DEPTH links,
+   which bounds the time spent with interrupts off.  Interrupts
+   must be off. */
+static void
+donate_priority (struct thread *t)
+{
+  int priority = t->priority;
+  int depth;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (depth = 0; depth < DONATION_DEPTH && t->waiting_lock != NULL; depth++)
+    {
+      t = t->waiting_lock->holder;
+      if (t == NULL || t->priority >= priority)
+        break;
+      thread_donate_priority (t, priority);
+    }
+}
+
 /* Tries to acquires LOCK and returns true if successful or false
    on failure.  The lock must not already be held by the current
    thread.
@@ -233,13 +282,18 @@ lock_try_acquire (struct lock *lock)
 
   success = sema_try_down (&lock->semaphore);
   if (success){
+    enum intr_level old_level = intr_disable ();
+    lock->acquire_cnt++;
     lock->holder = thread_current ();
-  //  list_push_back(&thread_current ()->lock_list, &lock->elem);
+    list_push_back (&thread_current ()->held_locks, &lock->elem);
+    intr_set_level (old_level);
   }
   return success;
 }
 
 /* Releases LOCK, which must be owned by the current thread.
+   Yields the CPU only if that lets a higher-priority thread run,
+   which cannot happen if no thread was waiting for LOCK.
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to release a lock within an interrupt
@@ -247,20 +301,20 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock) 
 {
-  struct thread *current_t;
-  int alt_priority = 0;
   enum intr_level old_level;
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
   old_level = intr_disable ();
-  current_t = thread_current();
-  /* Lower priority */
+  list_remove (&lock->elem);
+  /* Give back the priority donated for this lock. */
   if (!is_thread_mlfqs())
-    current_t->priority = current_t->orig_priority;
+    thread_refresh_priority ();
   lock->holder = NULL;
-  sema_up (&lock->semaphore);
-  thread_yield();
+  if (list_empty (&lock->semaphore.waiters))
+    lock->semaphore.value++;
+  else
+    sema_up (&lock->semaphore);
   intr_set_level (old_level);
 }
 
@@ -355,7 +409,6 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
     sema_up (&list_entry (max_priority,
                           struct semaphore_elem, elem)->semaphore);
   }
-  thread_yield();
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -374,6 +427,87 @@ cond_broadcast (struct condition *cond, struct lock *lock)
     cond_signal (cond, lock);
 }
 
+/* Initializes RWLOCK.  A readers-writer lock can be held either
+   by any number of readers or by a single writer.  Like a lock,
+   it is not recursive: a thread holding RWLOCK in either mode
+   must not try to acquire it again. */
+void
+rwlock_init (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_init (&rwlock->lock);
+  cond_init (&rwlock->readers_ok);
+  cond_init (&rwlock->writer_ok);
+  rwlock->reader_cnt = 0;
+  rwlock->writer_cnt = 0;
+  rwlock->waiting_writer_cnt = 0;
+}
+
+/* Acquires RWLOCK for reading, sleeping until no writer holds
+   it or is waiting for it. */
+void
+rwlock_acquire_read (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+
+  lock_acquire (&rwlock->lock);
+  while (rwlock->writer_cnt > 0 || rwlock->waiting_writer_cnt > 0)
+    cond_wait (&rwlock->readers_ok, &rwlock->lock);
+  rwlock->reader_cnt++;
+  lock_release (&rwlock->lock);
+}
+
+/* Releases RWLOCK, which the current thread must hold for
+   reading. */
+void
+rwlock_release_read (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_acquire (&rwlock->lock);
+  ASSERT (rwlock->reader_cnt > 0);
+  if (--rwlock->reader_cnt == 0 && rwlock->waiting_writer_cnt > 0)
+    cond_signal (&rwlock->writer_ok, &rwlock->lock);
+  lock_release (&rwlock->lock);
+}
+
+/* Acquires RWLOCK for writing, sleeping until no other thread
+   holds it. */
+void
+rwlock_acquire_write (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+
+  lock_acquire (&rwlock->lock);
+  rwlock->waiting_writer_cnt++;
+  while (rwlock->reader_cnt > 0 || rwlock->writer_cnt > 0)
+    cond_wait (&rwlock->writer_ok, &rwlock->lock);
+  rwlock->waiting_writer_cnt--;
+  rwlock->writer_cnt++;
+  lock_release (&rwlock->lock);
+}
+
+/* Releases RWLOCK, which the current thread must hold for
+   writing.  Another waiting writer goes next if there is one;
+   otherwise all waiting readers are let in. */
+void
+rwlock_release_write (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_acquire (&rwlock->lock);
+  ASSERT (rwlock->writer_cnt == 1);
+  rwlock->writer_cnt = 0;
+  if (rwlock->waiting_writer_cnt > 0)
+    cond_signal (&rwlock->writer_ok, &rwlock->lock);
+  else
+    cond_broadcast (&rwlock->readers_ok, &rwlock->lock);
+  lock_release (&rwlock->lock);
+}
+
 bool
 semaphore_elem_thread_priority_less (
     const struct list_elem *a,
@@ -22,7 +22,9 @@ struct lock
   {
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
-    struct list_elem elem;
+    struct list_elem elem;      /* Element in holder's held_locks. */
+    unsigned acquire_cnt;       /* Number of times acquired (for stats). */
+    unsigned contend_cnt;       /* Number of times found held (for stats). */
   };
 
 void lock_init (struct lock *);
@@ -42,6 +44,26 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock.
+   Any number of readers may hold it at once, or a single writer.
+   Waiting writers keep new readers out, so that a steady stream
+   of readers cannot starve them. */
+struct rwlock
+  {
+    struct lock lock;           /* Protects the members below. */
+    struct condition readers_ok; /* Signaled when readers may enter. */
+    struct condition writer_ok; /* Signaled when a writer may enter. */
+    int reader_cnt;             /* Number of readers holding the lock. */
+    int writer_cnt;             /* Number of writers holding it, 0 or 1. */
+    int waiting_writer_cnt;     /* Number of writers waiting for it. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+
 bool semaphore_elem_thread_priority_less (
     const struct list_elem *a,
     const struct list_elem *b,
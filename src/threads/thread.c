@@ -4,6 +4,7 @@
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/fixed_point_number.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
@@ -23,13 +24,16 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
-
-/* List of processes in THREAD_BLOCK state
-   made by jh2ekd */
-static struct list sleep_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running.  There is one FIFO
+   queue per priority.  Bit PRI_MAX - P of ready_mask is set if
+   and only if ready_queues[P] is nonempty, so that the lowest
+   set bit gives the highest priority with a ready thread.
+   Adding, removing and finding the next thread to run therefore
+   take constant time, however many threads are ready. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_mask;
+static int ready_cnt;           /* Number of threads in the queues. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -68,6 +72,27 @@ bool thread_mlfqs;
 
 static int fixed_load_avg;
 
+/* MLFQS bookkeeping.
+
+   Every CALC_PRIORITY_TICK ticks only the running thread's
+   recent_cpu has changed, so only its priority is recomputed.
+   Once a second, recent_cpu decays for every thread, but only
+   the running and ready threads, whose priorities matter right
+   away, are brought up to date; the ready queues are rebuilt in
+   the process.  A blocked thread catches up on the seconds it
+   missed when it is unblocked, using the decay coefficients
+   recorded below.  So the timer interrupt never walks all_list,
+   and its cost depends only on the number of ready threads. */
+static int mlfqs_seconds;               /* Decays applied so far. */
+#define DECAY_HISTORY 64                /* Coefficients remembered. */
+static int decay_coef[DECAY_HISTORY];   /* Coefficient of each decay. */
+
+static void mlfqs_tick (struct thread *);
+static void mlfqs_second (struct thread *);
+static void mlfqs_catch_up (struct thread *);
+static void mlfqs_update_priority (struct thread *);
+static int round_to_int (int);
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
@@ -79,8 +104,12 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static void ready_push (struct thread *);
+static struct thread *ready_pop (void);
+static void ready_remove (struct thread *);
+static int ready_max_priority (void);
 
-#define ready_threads ((int)list_size(&ready_list) + (thread_current () != idle_thread? 1 : 0))
+#define ready_threads (ready_cnt + (thread_current () != idle_thread? 1 : 0))
 
 #define fixed_point_f 16384 //16384 = 2^14. It is 17.14 fixed-point
 #define CALC_PRIORITY_TICK 4
@@ -101,12 +130,14 @@ static tid_t allocate_tid (void);
 void
 thread_init (void) 
 {
+  int priority;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (priority = PRI_MIN; priority <= PRI_MAX; priority++)
+    list_init (&ready_queues[priority]);
   list_init (&all_list);
-  list_init (&sleep_list);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
@@ -139,9 +170,6 @@ void
 thread_tick (void) 
 {
   struct thread *t = thread_current ();
-  struct thread *t_e;
-  struct list_elem *e;
-  bool any_unblock = false;
   enum intr_level old_level;
 
   old_level = intr_disable ();
@@ -155,15 +183,9 @@ thread_tick (void)
   else
     kernel_ticks++;
 
-    /* Wake sleeping threads */
-  while (list_entry(list_begin (&sleep_list), struct thread, sleepelem) -> waketime <=timer_ticks()
-      && list_begin (&sleep_list) != list_end (&sleep_list)){
-    thread_unblock(list_entry(list_pop_front(&sleep_list), struct thread, sleepelem));
-    any_unblock = true;
-  }
+  if (thread_mlfqs)
+    mlfqs_tick (t);
 
-  if (any_unblock)
-    intr_yield_on_return();
   /* Enforce preemption. */
   if (++thread_ticks >= TIME_SLICE)
     intr_yield_on_return ();
@@ -176,6 +198,8 @@ thread_print_stats (void)
 {
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  printf ("Thread: tid lock acquired %u times, %u contended\n",
+          tid_lock.acquire_cnt, tid_lock.contend_cnt);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -215,6 +239,13 @@ thread_create (const char *name, int priority,
   /* Initialize thread. */
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
+  if (thread_mlfqs)
+    {
+      /* Inherit the creator's niceness and CPU usage. */
+      t->nice = thread_current ()->nice;
+      t->fixed_recent_cpu = thread_current ()->fixed_recent_cpu;
+      mlfqs_update_priority (t);
+    }
 
   /* For Project #2 */
   list_push_back (&thread_current()->children_list, &t->childelem);
@@ -284,39 +315,88 @@ thread_unblock (struct thread *t)
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
   
-  list_insert_ordered (&ready_list, &t->elem, (list_less_func*)thread_priority_more, NULL);
+  if (thread_mlfqs)
+    {
+      mlfqs_catch_up (t);
+      mlfqs_update_priority (t);
+    }
+  ready_push (t);
   t->status = THREAD_READY;
 
   intr_set_level (old_level);
 }
 
-/* put thread into sleep_list and block it */
+/* Yields the CPU if a ready thread has a higher priority than
+   the running thread.  Within an interrupt handler, yields on
+   return from the interrupt instead. */
 void
-thread_sleep (int64_t waketime)
+thread_yield_to_higher (void)
 {
-  void* aux;
-  struct thread* cur = thread_current();
-  enum intr_level old_level;
-
-  old_level = intr_disable ();
-  (cur->waketime) = waketime;
-  aux = 0;
-  list_insert_ordered (&sleep_list, &(cur->sleepelem),
-      (list_less_func*)thread_waketime_less, aux);
-  thread_block ();
+  enum intr_level old_level = intr_disable ();
+  bool yield = ready_max_priority () > thread_current ()->priority;
   intr_set_level (old_level);
+
+  if (yield)
+    {
+      if (intr_context ())
+        intr_yield_on_return ();
+      else
+        thread_yield ();
+    }
 }
 
-bool thread_waketime_less (const struct list_elem *a,
-    const struct list_elem *b, void *aux UNUSED){
-  struct thread* thread_a = (struct thread*)(list_entry(a, struct thread, sleepelem));
-  struct thread* thread_b = (struct thread*)(list_entry(b, struct thread, sleepelem));
-  if ( thread_a->waketime == thread_b->waketime )
-    return thread_a->priority > thread_b->priority?
-      true : false;
+/* Raises thread T's priority to NEW_PRIORITY, if that is higher,
+   on behalf of a thread waiting for a lock that T holds.  If T
+   is ready, moves it to the ready queue for its new priority.
+   Interrupts must be off. */
+void
+thread_donate_priority (struct thread *t, const int new_priority)
+{
+  ASSERT (is_thread (t));
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (new_priority <= t->priority)
+    return;
+  if (t->status == THREAD_READY)
+    {
+      ready_remove (t);
+      t->priority = new_priority;
+      ready_push (t);
+    }
   else
-  return thread_a->waketime < thread_b->waketime?
-    true : false;
+    t->priority = new_priority;
+}
+
+/* Recomputes the running thread's priority as the higher of its
+   own priority and the highest priority of the threads waiting
+   for the locks it holds.  Called when the thread releases a
+   lock or changes its own priority.  Interrupts must be off. */
+void
+thread_refresh_priority (void)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+  int priority = cur->orig_priority;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&cur->held_locks); e != list_end (&cur->held_locks);
+       e = list_next (e))
+    {
+      struct lock *lock = list_entry (e, struct lock, elem);
+      struct list *waiters = &lock->semaphore.waiters;
+
+      if (!list_empty (waiters))
+        {
+          struct thread *t = list_entry (list_min (waiters,
+                                                   thread_priority_more,
+                                                   NULL),
+                                         struct thread, elem);
+          if (t->priority > priority)
+            priority = t->priority;
+        }
+    }
+  cur->priority = priority;
 }
 
 bool thread_priority_more (const struct list_elem *a,
@@ -392,9 +472,9 @@ thread_yield (void)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  if (cur->priority <= list_entry(list_begin(&ready_list), struct thread, elem)->priority){
+  if (cur->priority <= ready_max_priority ()){
     if (cur != idle_thread){ 
-      list_insert_ordered (&ready_list, &cur->elem, (list_less_func*)thread_priority_more, NULL);
+      ready_push (cur);
       cur->status = THREAD_READY;
       schedule ();
     }
@@ -424,10 +504,18 @@ void
 thread_set_priority (int new_priority) 
 {
   struct thread* current_t = thread_current ();
-  //int alt_priority = 0;
-  //current_t->orig_priority = new_priority;
-  current_t->priority = new_priority;
-  thread_yield();
+  enum intr_level old_level;
+
+  if (thread_mlfqs)
+    return;
+
+  /* A priority donated to the thread stays in force until the
+     lock it was donated for is released. */
+  old_level = intr_disable ();
+  current_t->orig_priority = new_priority;
+  thread_refresh_priority ();
+  intr_set_level (old_level);
+  thread_yield_to_higher ();
 }
 
 /* Returns the current thread's priority. */
@@ -442,9 +530,13 @@ void
 thread_set_nice (int nice) 
 {
   struct thread *t = thread_current();
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
   t->nice = nice;
-  //t->priority =  PRI_MAX-div_x_n (t->fixed_recent_cpu, 4)-(nice*2);
-  thread_yield();
+  mlfqs_update_priority (t);
+  intr_set_level (old_level);
+  thread_yield_to_higher ();
 }
 
 /* Returns the current thread's nice value. */
@@ -458,14 +550,141 @@ thread_get_nice (void)
 int
 thread_get_load_avg (void) 
 {
-  //return round2int (mul_x_n (fixed_load_avg, 100));
+  enum intr_level old_level = intr_disable ();
+  int load_avg = fixed_load_avg;
+  intr_set_level (old_level);
+
+  return round_to_int (multiply_int (load_avg, 100));
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) 
 {
-  //return round2int (mul_x_n (thread_current()->fixed_recent_cpu, 100));
+  enum intr_level old_level = intr_disable ();
+  int recent_cpu = thread_current ()->fixed_recent_cpu;
+  intr_set_level (old_level);
+
+  return round_to_int (multiply_int (recent_cpu, 100));
+}
+
+/* Returns fixed-point X rounded to the nearest integer. */
+static int
+round_to_int (int x)
+{
+  int half = convert_to_fixed_point (1) / 2;
+  return divide_int (x >= 0 ? x + half : x - half,
+                     convert_to_fixed_point (1));
+}
+
+/* Updates the MLFQS statistics at a timer tick, while CUR is
+   running.  Runs in the timer interrupt. */
+static void
+mlfqs_tick (struct thread *cur)
+{
+  int64_t ticks = timer_ticks ();
+
+  if (cur != idle_thread)
+    cur->fixed_recent_cpu = add_int (cur->fixed_recent_cpu, 1);
+  if (ticks % TIMER_FREQ == 0)
+    mlfqs_second (cur);
+  else if (ticks % CALC_PRIORITY_TICK == 0 && cur != idle_thread)
+    mlfqs_update_priority (cur);
+
+  if (ready_max_priority () > cur->priority)
+    intr_yield_on_return ();
+}
+
+/* Updates load_avg and decays recent_cpu, once a second, while
+   CUR is running.  Recomputes the priority of CUR and of each
+   ready thread, moving the latter to their new queues. */
+static void
+mlfqs_second (struct thread *cur)
+{
+  struct list ready;
+  int twice_load, priority;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* load_avg = (59/60) * load_avg + (1/60) * ready_threads. */
+  fixed_load_avg = add_float (
+    divide_int (multiply_int (fixed_load_avg, 59), 60),
+    divide_int (convert_to_fixed_point (ready_threads), 60));
+
+  /* Record this second's coefficient,
+     (2 * load_avg) / (2 * load_avg + 1). */
+  twice_load = multiply_int (fixed_load_avg, 2);
+  decay_coef[mlfqs_seconds % DECAY_HISTORY]
+    = divide_float (twice_load, add_int (twice_load, 1));
+  mlfqs_seconds++;
+
+  if (cur != idle_thread)
+    {
+      mlfqs_catch_up (cur);
+      mlfqs_update_priority (cur);
+    }
+
+  /* Empty the ready queues, highest priority first, and refill
+     them with the new priorities. */
+  list_init (&ready);
+  for (priority = PRI_MAX; priority >= PRI_MIN; priority--)
+    while (!list_empty (&ready_queues[priority]))
+      list_push_back (&ready, list_pop_front (&ready_queues[priority]));
+  ready_mask = 0;
+  ready_cnt = 0;
+  while (!list_empty (&ready))
+    {
+      struct thread *t = list_entry (list_pop_front (&ready),
+                                     struct thread, elem);
+      mlfqs_catch_up (t);
+      mlfqs_update_priority (t);
+      ready_push (t);
+    }
+}
+
+/* Applies to T's recent_cpu each once-a-second decay,
+   recent_cpu = coefficient * recent_cpu + nice, that it has
+   missed.  Only the last DECAY_HISTORY coefficients are kept;
+   a thread that has been blocked for longer has decayed so far
+   that its older recent_cpu is taken to be 0. */
+static void
+mlfqs_catch_up (struct thread *t)
+{
+  int missed = mlfqs_seconds - t->decay_epoch;
+  int second;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (missed > DECAY_HISTORY)
+    {
+      t->fixed_recent_cpu = 0;
+      missed = DECAY_HISTORY;
+    }
+  for (second = mlfqs_seconds - missed; second < mlfqs_seconds; second++)
+    t->fixed_recent_cpu = add_int (
+      multiply_float (decay_coef[second % DECAY_HISTORY],
+                      t->fixed_recent_cpu),
+      t->nice);
+  t->decay_epoch = mlfqs_seconds;
+}
+
+/* Sets T's priority to
+   PRI_MAX - (recent_cpu / 4) - (nice * 2),
+   rounded down and clamped to PRI_MIN...PRI_MAX.  T must not be
+   in a ready queue. */
+static void
+mlfqs_update_priority (struct thread *t)
+{
+  int priority = convert_to_int (
+    sub_int (sub_float (convert_to_fixed_point (PRI_MAX),
+                        divide_int (t->fixed_recent_cpu, 4)),
+             t->nice * 2));
+
+  if (priority < PRI_MIN)
+    priority = PRI_MIN;
+  else if (priority > PRI_MAX)
+    priority = PRI_MAX;
+  t->priority = priority;
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -490,6 +709,9 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Stop the timer interrupt until it is needed. */
+      timer_idle ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -553,6 +775,9 @@ init_thread (struct thread *t, const char *name, int priority)
   t->stack = (uint8_t *) t + PGSIZE;
   t->orig_priority = priority;
   t->priority = priority;
+  t->decay_epoch = mlfqs_seconds;
+  if (thread_mlfqs)
+    mlfqs_update_priority (t);
   t->magic = THREAD_MAGIC;
   
   /* Added for Userprog */
@@ -563,6 +788,7 @@ init_thread (struct thread *t, const char *name, int priority)
   sema_init (&t->sema_for_kill, 0);
   sema_init (&t->sema_for_wait, 0);
   list_init (&t->children_list);
+  list_init (&t->held_locks);
 
   memset (&t->fd_list, 0, (sizeof(struct file*)) * FD_MAX);
   t->num_files = 2;
@@ -590,12 +816,77 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-  struct list_elem *t_e;
-  if (list_empty (&ready_list))
+  if (ready_cnt == 0)
     return idle_thread;
-  else{
-      return list_entry (list_pop_front (&ready_list), struct thread, elem);
-  }
+  else
+    return ready_pop ();
+}
+
+/* Adds T to the back of the run queue for its priority.
+   Interrupts must be off. */
+static void
+ready_push (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= t->priority && t->priority <= PRI_MAX);
+
+  list_push_back (&ready_queues[t->priority], &t->elem);
+  ready_mask |= (uint64_t) 1 << (PRI_MAX - t->priority);
+  ready_cnt++;
+}
+
+/* Returns the bit number of the lowest set bit in ready_mask,
+   which must be nonzero. */
+static inline int
+ready_mask_ffs (void)
+{
+  uint32_t low = ready_mask;
+
+  ASSERT (ready_mask != 0);
+  if (low != 0)
+    return __builtin_ctz (low);
+  else
+    return 32 + __builtin_ctz ((uint32_t) (ready_mask >> 32));
+}
+
+/* Returns the priority of the highest-priority ready thread, or
+   PRI_MIN - 1 if no thread is ready.  Interrupts must be off. */
+static int
+ready_max_priority (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  return ready_mask != 0 ? PRI_MAX - ready_mask_ffs () : PRI_MIN - 1;
+}
+
+/* Removes and returns the thread that has waited longest among
+   those of the highest priority that are ready.  At least one
+   thread must be ready, and interrupts must be off. */
+static struct thread *
+ready_pop (void)
+{
+  int priority = ready_max_priority ();
+  struct list *queue = &ready_queues[priority];
+  struct thread *t = list_entry (list_pop_front (queue), struct thread, elem);
+
+  if (list_empty (queue))
+    ready_mask &= ~((uint64_t) 1 << (PRI_MAX - priority));
+  ready_cnt--;
+  return t;
+}
+
+/* Removes ready thread T from its ready queue.  Interrupts must
+   be off. */
+static void
+ready_remove (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[t->priority]))
+    ready_mask &= ~((uint64_t) 1 << (PRI_MAX - t->priority));
+  ready_cnt--;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -2,6 +2,7 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
 #include <stdint.h>
 #include "threads/synch.h"
@@ -90,26 +91,29 @@ struct thread
     enum thread_status status;          /* Thread state. */
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int orig_priority;
+    int orig_priority;                  /* Priority before donation. */
     int priority;                       /* Priority. */
     struct list_elem allelem;           /* List element for all threads list. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
-    struct list_elem sleepelem; 
     struct list_elem childelem;
+    struct list held_locks;             /* Locks held, for donation. */
+    struct lock *waiting_lock;          /* Lock being waited for, or null. */
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+    uint8_t *bounce_page;               /* Staging page for reads, or null. */
+    struct hash pages;                  /* Pages not loaded yet. */
 #endif
 
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
-    int64_t waketime;                   /* time to wake */
 
 
     int fixed_recent_cpu; //For project #1, advanced shceduling
     int nice;
+    int decay_epoch;                    /* Seconds of decay in recent_cpu. */
 
     int exit_code; //For project #2
     bool end;
@@ -144,7 +148,6 @@ tid_t thread_create (const char *name, int priority, thread_func *, void *);
 
 void thread_block (void);
 void thread_unblock (struct thread *);
-void thread_sleep (int64_t waketime);
 
 struct thread *thread_current (void);
 tid_t thread_tid (void);
@@ -152,6 +155,7 @@ const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
+void thread_yield_to_higher (void);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
@@ -165,12 +169,11 @@ void thread_set_nice (int);
 int thread_get_recent_cpu (void);
 int thread_get_load_avg (void);
 
-bool thread_waketime_less (const struct list_elem *a,
-		    const struct list_elem *b, void *aux);
 bool thread_priority_more (const struct list_elem *a,
 		    const struct list_elem *b, void *aux);
 
 void thread_donate_priority(struct thread *thread, const int new_priority);
+void thread_refresh_priority (void);
 
 int conv2fixed (int n);
 int floor2int (int x);
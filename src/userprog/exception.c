@@ -2,9 +2,11 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include "userprog/gdt.h"
+#include "userprog/page.h"
 #include "userprog/syscall.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -21,9 +23,9 @@ static void page_fault (struct intr_frame *);
    signals.  Instead, we'll make them simply kill the user
    process.
 
-   Page faults are an exception.  Here they are treated the same
-   way as other exceptions, but this will need to change to
-   implement virtual memory.
+   Page faults are an exception.  A fault on a page of the
+   program that has not been loaded yet brings that page in; any
+   other page fault kills the process.
 
    Refer to [IA32-v3a] section 5.15 "Exception and Interrupt
    Reference" for a description of each of these exceptions. */
@@ -149,6 +151,12 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+  /* Bring in a page that load() left to be loaded on first
+     access.  This also covers kernel accesses to user memory
+     made by system calls on the process's behalf. */
+  if (not_present && is_user_vaddr (fault_addr) && page_load (fault_addr))
+    return;
+
   /* Added by GJ
      This should be terminated! */
   exit(-1);
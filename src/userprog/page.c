@@ -0,0 +1,212 @@
+#include "userprog/page.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "userprog/pagedir.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Supplemental page table.
+
+   load() does not read a program's segments into memory.  It
+   records each of their pages here instead, in the loading
+   thread's PAGES table, and leaves it unmapped in the page
+   directory.  The first access to such a page, by the process
+   itself or by a system call on its behalf, causes a page fault,
+   and page_load() then reads the page from the executable, or
+   zeroes it, maps it and drops it from the table.  Pages that
+   are never touched thus never take a frame or any disk I/O.
+
+   There is no eviction, so a page that has been loaded stays
+   mapped until the process exits. */
+
+/* A page of user memory that is not loaded yet. */
+struct page
+  {
+    struct hash_elem elem;      /* Element in the thread's PAGES. */
+    void *upage;                /* User virtual address. */
+    struct file *file;          /* File to read from, if READ_BYTES > 0. */
+    off_t ofs;                  /* Offset of the page's data in FILE. */
+    size_t read_bytes;          /* Bytes to read; the rest are zeroed. */
+    bool writable;              /* Map the page writable? */
+  };
+
+/* Cache of `struct page's. */
+static struct kmem_cache page_cache;
+
+/* Numbers of pages recorded and loaded. */
+static long long add_cnt;
+static long long load_cnt;
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func destroy_page;
+static struct page *lookup_page (void *upage);
+
+/* Initializes the supplemental page table module. */
+void
+page_init (void)
+{
+  kmem_cache_init (&page_cache, "page", sizeof (struct page), NULL);
+}
+
+/* Initializes the current thread's supplemental page table.
+   Returns true if successful, false if memory is short. */
+bool
+page_table_init (void)
+{
+  return hash_init (&thread_current ()->pages, page_hash, page_less, NULL);
+}
+
+/* Frees the current thread's supplemental page table.  It is
+   safe to call this for a thread whose table was never
+   initialized, because the table is zeroed with the rest of the
+   thread and so has no buckets. */
+void
+page_table_destroy (void)
+{
+  hash_destroy (&thread_current ()->pages, destroy_page);
+}
+
+/* Records that the page at UPAGE in the current process is to be
+   loaded on first access by reading READ_BYTES bytes from FILE,
+   starting at offset OFS, and zeroing the rest of the page.  If
+   READ_BYTES is 0, FILE is not used and the page is simply
+   zeroed.  The page will be mapped writable if WRITABLE is true,
+   read-only otherwise.  Returns true if successful, false if
+   UPAGE is already recorded or memory is short. */
+bool
+page_add (void *upage, struct file *file, off_t ofs, size_t read_bytes,
+          bool writable)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (read_bytes <= PGSIZE);
+
+  if (pagedir_get_page (t->pagedir, upage) != NULL)
+    return false;
+
+  p = kmem_cache_alloc (&page_cache);
+  if (p == NULL)
+    return false;
+  p->upage = upage;
+  p->file = file;
+  p->ofs = ofs;
+  p->read_bytes = read_bytes;
+  p->writable = writable;
+  if (hash_insert (&t->pages, &p->elem) != NULL)
+    {
+      kmem_cache_free (&page_cache, p);
+      return false;
+    }
+  add_cnt++;
+  return true;
+}
+
+/* Loads and maps the page containing ADDR in the current
+   process, if it was recorded with page_add() and not loaded
+   yet.  Returns true if successful, false if there is no such
+   page or it cannot be loaded. */
+bool
+page_load (const void *addr)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+  uint8_t *kpage;
+
+  if (t->pagedir == NULL)
+    return false;
+  p = lookup_page (pg_round_down (addr));
+  if (p == NULL)
+    return false;
+
+  kpage = palloc_get_page (PAL_USER | (p->read_bytes == 0 ? PAL_ZERO : 0));
+  if (kpage == NULL)
+    return false;
+  if (p->read_bytes > 0)
+    {
+      if (file_read_at (p->file, kpage, p->read_bytes, p->ofs)
+          != (off_t) p->read_bytes)
+        {
+          palloc_free_page (kpage);
+          return false;
+        }
+      memset (kpage + p->read_bytes, 0, PGSIZE - p->read_bytes);
+    }
+  if (!pagedir_set_page (t->pagedir, p->upage, kpage, p->writable))
+    {
+      palloc_free_page (kpage);
+      return false;
+    }
+
+  hash_delete (&t->pages, &p->elem);
+  kmem_cache_free (&page_cache, p);
+  load_cnt++;
+  return true;
+}
+
+/* Loads every page recorded with page_add() that overlaps the
+   SIZE bytes starting at user address BUFFER.  System calls call
+   this before handing a user buffer to the file system, so that
+   copying to or from it cannot fault while file system locks
+   are held. */
+void
+page_prefault (const void *buffer, size_t size)
+{
+  const uint8_t *upage = pg_round_down (buffer);
+  const uint8_t *end = (const uint8_t *) buffer + size;
+
+  for (; upage < end && is_user_vaddr (upage); upage += PGSIZE)
+    page_load (upage);
+}
+
+/* Prints supplemental page table statistics. */
+void
+page_print_stats (void)
+{
+  printf ("Paging: %lld of %lld program pages loaded on demand\n",
+          load_cnt, add_cnt);
+}
+
+/* Returns a hash value for page E. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (e, struct page, elem);
+  return hash_bytes (&p->upage, sizeof p->upage);
+}
+
+/* Returns true if page A's address precedes page B's. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, elem);
+  const struct page *b = hash_entry (b_, struct page, elem);
+  return a->upage < b->upage;
+}
+
+/* Frees page E, when its table is destroyed. */
+static void
+destroy_page (struct hash_elem *e, void *aux UNUSED)
+{
+  kmem_cache_free (&page_cache, hash_entry (e, struct page, elem));
+}
+
+/* Returns the current thread's unloaded page at UPAGE, or a null
+   pointer if there is none. */
+static struct page *
+lookup_page (void *upage)
+{
+  struct page p;
+  struct hash_elem *e;
+
+  p.upage = upage;
+  e = hash_find (&thread_current ()->pages, &p.elem);
+  return e != NULL ? hash_entry (e, struct page, elem) : NULL;
+}
@@ -0,0 +1,17 @@
+#ifndef USERPROG_PAGE_H
+#define USERPROG_PAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/file.h"
+
+void page_init (void);
+bool page_table_init (void);
+void page_table_destroy (void);
+bool page_add (void *upage, struct file *, off_t ofs, size_t read_bytes,
+               bool writable);
+bool page_load (const void *addr);
+void page_prefault (const void *buffer, size_t size);
+void page_print_stats (void);
+
+#endif /* userprog/page.h */
@@ -1,5 +1,6 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
@@ -11,7 +12,10 @@
 #include "filesys/filesys.h"
 #include "devices/input.h"
 #include "devices/shutdown.h"
+#include "threads/palloc.h"
 #include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/page.h"
 
 #include "filesys/inode.h"
 #include "filesys/file.h"
@@ -24,6 +28,7 @@ static tid_t exec(void *cmd_line);
 static int write (int fd, void *buffer, unsigned size);
 static int wait(int  pid);
 static int read (int fd, void *buffer, unsigned size);
+static int read_file (struct file *, uint8_t *buffer, unsigned size);
 static bool create (void *file, unsigned initial_size);
 static bool remove (void *file);
 static int open (void *file);
@@ -35,7 +40,6 @@ void valid_address_check(void* addr);
 void valid_stack_check(struct intr_frame* intr_f, int num);
 
 bool mkdir(char* dir_name);
-struct lock dir_lock;
 //void valid_fd(struct intr_frame* f, int res, int fd); 
 
 /*
@@ -53,7 +57,6 @@ void
 syscall_init (void) 
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
-  lock_init(&dir_lock);
 }
 
 static void
@@ -158,9 +161,7 @@ syscall_handler (struct intr_frame *f)
   // ADDED FOR PROJECT 4
   case SYS_MKDIR:
     dir_name = (char*) *((int*)f->esp+1);
-    lock_acquire(&dir_lock);
     f->eax = filesys_create(true, dir_name, 0);
-    lock_release(&dir_lock);
     break;
   
   case SYS_CHDIR:
@@ -322,6 +323,11 @@ static int
 write (int fd, void *buffer, unsigned size)
 {
   char *buffer_charptr = (char*)buffer;
+
+  /* Load BUFFER now, so that it does not fault while the console
+     or file system is locked. */
+  page_prefault (buffer, size);
+
   //when writing to the console!
   if (fd == 1){
     putbuf(buffer_charptr, size);
@@ -357,11 +363,61 @@ read (int fd, void *buffer, unsigned size)
     if (thread_current()->fd_list[fd] == NULL)
       return -1;
     else
-      return file_read (thread_current()->fd_list[fd], buffer, size);
+      return read_file (thread_current()->fd_list[fd], buffer, size);
   }
   return size;
 }
 
+/* Reads SIZE bytes from FILE into user BUFFER, one user page at
+   a time.  A page that is mapped writable is filled through its
+   kernel alias, so whole sectors move straight from the disk or
+   the buffer cache into the process's frame: one copy per byte
+   at most, and no allocation.  Any other page is read into the
+   thread's bounce page, allocated on first use and kept until
+   the process exits, and copied out from there, faulting if the
+   page is not really writable.  Pages of BUFFER that have not
+   been loaded yet are loaded first, so that they take the
+   direct path.  Returns -1 if the bounce page is needed but
+   cannot be allocated.  Terminates the process if BUFFER does
+   not lie entirely in user memory. */
+static int
+read_file (struct file *file, uint8_t *buffer, unsigned size)
+{
+  struct thread *t = thread_current ();
+  unsigned bytes_read = 0;
+
+  if (size > (uintptr_t) PHYS_BASE - (uintptr_t) buffer)
+    exit (-1);
+  page_prefault (buffer, size);
+
+  while (bytes_read < size)
+    {
+      uint8_t *upage = buffer + bytes_read;
+      unsigned chunk = PGSIZE - pg_ofs (upage);
+      uint8_t *kpage = pagedir_get_page (t->pagedir, upage);
+      off_t n;
+
+      if (chunk > size - bytes_read)
+        chunk = size - bytes_read;
+      if (kpage != NULL && pagedir_is_writable (t->pagedir, upage))
+        n = file_read (file, kpage, chunk);
+      else
+        {
+          if (t->bounce_page == NULL)
+            t->bounce_page = palloc_get_page (0);
+          if (t->bounce_page == NULL)
+            return -1;
+          n = file_read (file, t->bounce_page, chunk);
+          memcpy (upage, t->bounce_page, n);
+        }
+
+      bytes_read += n;
+      if ((unsigned) n < chunk)
+        break;
+    }
+  return bytes_read;
+}
+
 /*
 static int process_add_file(struct file *f){
   struct process_file *pf=malloc(sizeof(struct process_file));